@@ -0,0 +1,326 @@
+//////////////////////////////////////////////////////////////////////////////////
+// Timed Exec - Command-Line Benchmarking Utility
+// Copyright (c) 2023 LoRd_MuldeR <mulder2@gmx.de>. Some rights reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+//////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+
+#define NOMINMAX 1
+#define WIN32_LEAN_AND_MEAN 1
+#include <Windows.h>
+
+#define PSAPI_VERSION 1
+#include <Psapi.h>
+
+#include "AllocHook.h"
+
+#define MAX_MODULES 1024
+
+#ifdef _WIN64
+#  define INTERLOCKED_ADD_PTR(X,Y) InterlockedExchangeAdd64((X),(Y))
+#  define INTERLOCKED_CAS_PTR(X,Y,Z) InterlockedCompareExchange64((X),(Y),(Z))
+#else
+#  define INTERLOCKED_ADD_PTR(X,Y) InterlockedExchangeAdd((X),(Y))
+#  define INTERLOCKED_CAS_PTR(X,Y,Z) InterlockedCompareExchange((X),(Y),(Z))
+#endif
+
+typedef LPVOID (WINAPI *HeapAllocFn)(HANDLE, DWORD, SIZE_T);
+typedef LPVOID (WINAPI *HeapReAllocFn)(HANDLE, DWORD, LPVOID, SIZE_T);
+typedef BOOL (WINAPI *HeapFreeFn)(HANDLE, DWORD, LPVOID);
+
+static HMODULE g_hInstance = NULL;
+static alloc_hook_data_t *g_data = NULL;
+static DWORD g_tlsIndex = TLS_OUT_OF_INDEXES;
+
+static HeapAllocFn g_heapAlloc = NULL;
+static HeapReAllocFn g_heapReAlloc = NULL;
+static HeapFreeFn g_heapFree = NULL;
+
+/* ======================================================================= */
+/* Counters                                                                */
+/* ======================================================================= */
+
+static alloc_hook_counters_t *getCounters(void)
+{
+	// TlsGetValue() resets the last error, but the caller of the heap function may still rely on it
+	const DWORD lastError = GetLastError();
+	alloc_hook_counters_t *counters = (alloc_hook_counters_t*)TlsGetValue(g_tlsIndex);
+	if (!counters)
+	{
+		const LONG index = InterlockedIncrement(&g_data->threadCount) - 1L;
+		counters = (index < ALLOC_HOOK_MAX_THREADS) ? &g_data->threads[index] : &g_data->overflow;
+		TlsSetValue(g_tlsIndex, counters);
+	}
+	SetLastError(lastError);
+	return counters;
+}
+
+static void addCounter(volatile LONGLONG &counter, const LONGLONG value, const bool shared)
+{
+	if (shared)
+	{
+		LONGLONG current = counter, previous;
+		while ((previous = InterlockedCompareExchange64(&counter, current + value, current)) != current)
+		{
+			current = previous;
+		}
+	}
+	else
+	{
+		counter += value;
+	}
+}
+
+static void addLiveBytes(const LONG_PTR delta)
+{
+	const LONG_PTR liveBytes = INTERLOCKED_ADD_PTR(&g_data->liveBytes, delta) + delta;
+	LONG_PTR peakLiveBytes = g_data->peakLiveBytes;
+	while (liveBytes > peakLiveBytes)
+	{
+		const LONG_PTR previous = INTERLOCKED_CAS_PTR(&g_data->peakLiveBytes, liveBytes, peakLiveBytes);
+		if (previous == peakLiveBytes)
+		{
+			break;
+		}
+		peakLiveBytes = previous;
+	}
+}
+
+static SIZE_T getBlockSize(const HANDLE hHeap, const DWORD dwFlags, LPCVOID lpMem)
+{
+	if (lpMem)
+	{
+		const SIZE_T size = HeapSize(hHeap, dwFlags & HEAP_NO_SERIALIZE, lpMem);
+		return (size != ((SIZE_T)-1)) ? size : 0U;
+	}
+	return 0U;
+}
+
+/* ======================================================================= */
+/* Hook Functions                                                          */
+/* ======================================================================= */
+
+static LPVOID WINAPI hookHeapAlloc(HANDLE hHeap, DWORD dwFlags, SIZE_T dwBytes)
+{
+	const LPVOID block = g_heapAlloc(hHeap, dwFlags, dwBytes);
+	if (block)
+	{
+		alloc_hook_counters_t *const counters = getCounters();
+		const bool shared = (counters == &g_data->overflow);
+		addCounter(counters->allocations, 1LL, shared);
+		addCounter(counters->bytesAllocated, (LONGLONG)dwBytes, shared);
+		addLiveBytes((LONG_PTR)dwBytes);
+	}
+	return block;
+}
+
+static LPVOID WINAPI hookHeapReAlloc(HANDLE hHeap, DWORD dwFlags, LPVOID lpMem, SIZE_T dwBytes)
+{
+	const SIZE_T previousSize = getBlockSize(hHeap, dwFlags, lpMem);
+	const LPVOID block = g_heapReAlloc(hHeap, dwFlags, lpMem, dwBytes);
+	if (block)
+	{
+		alloc_hook_counters_t *const counters = getCounters();
+		const bool shared = (counters == &g_data->overflow);
+		addCounter(counters->reallocations, 1LL, shared);
+		addCounter(counters->bytesAllocated, (LONGLONG)dwBytes, shared);
+		addLiveBytes((LONG_PTR)dwBytes - (LONG_PTR)previousSize);
+	}
+	return block;
+}
+
+static BOOL WINAPI hookHeapFree(HANDLE hHeap, DWORD dwFlags, LPVOID lpMem)
+{
+	const SIZE_T size = getBlockSize(hHeap, dwFlags, lpMem);
+	const BOOL success = g_heapFree(hHeap, dwFlags, lpMem);
+	if (success && lpMem)
+	{
+		alloc_hook_counters_t *const counters = getCounters();
+		addCounter(counters->frees, 1LL, (counters == &g_data->overflow));
+		addLiveBytes(-((LONG_PTR)size));
+	}
+	return success;
+}
+
+static const struct
+{
+	const char *name;
+	ULONG_PTR replacement;
+}
+HOOK_FUNCTIONS[] =
+{
+	{ "HeapAlloc",   (ULONG_PTR)&hookHeapAlloc   },
+	{ "HeapReAlloc", (ULONG_PTR)&hookHeapReAlloc },
+	{ "HeapFree",    (ULONG_PTR)&hookHeapFree    }
+};
+
+/* ======================================================================= */
+/* Import Address Table                                                    */
+/* ======================================================================= */
+
+static void patchThunk(IMAGE_THUNK_DATA *const thunk, const ULONG_PTR address)
+{
+	DWORD oldProtect;
+	if (VirtualProtect(&thunk->u1.Function, sizeof(thunk->u1.Function), PAGE_READWRITE, &oldProtect))
+	{
+		thunk->u1.Function = address;
+		VirtualProtect(&thunk->u1.Function, sizeof(thunk->u1.Function), oldProtect, &oldProtect);
+	}
+}
+
+static void patchModule(const HMODULE hModule)
+{
+	BYTE *const base = (BYTE*)hModule;
+	const IMAGE_DOS_HEADER *const dosHeader = (const IMAGE_DOS_HEADER*)base;
+	if (dosHeader->e_magic != IMAGE_DOS_SIGNATURE)
+	{
+		return;
+	}
+
+	const IMAGE_NT_HEADERS *const ntHeaders = (const IMAGE_NT_HEADERS*)(base + dosHeader->e_lfanew);
+	if ((ntHeaders->Signature != IMAGE_NT_SIGNATURE) || (ntHeaders->OptionalHeader.NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_IMPORT))
+	{
+		return;
+	}
+
+	const IMAGE_DATA_DIRECTORY &directory = ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+	if ((directory.VirtualAddress == 0U) || (directory.Size == 0U))
+	{
+		return;
+	}
+
+	for (const IMAGE_IMPORT_DESCRIPTOR *descriptor = (const IMAGE_IMPORT_DESCRIPTOR*)(base + directory.VirtualAddress); descriptor->Name; ++descriptor)
+	{
+		// Without the "original" thunks, the names of the imported functions are unknown
+		if (!descriptor->OriginalFirstThunk)
+		{
+			continue;
+		}
+		const IMAGE_THUNK_DATA *nameThunk = (const IMAGE_THUNK_DATA*)(base + descriptor->OriginalFirstThunk);
+		IMAGE_THUNK_DATA *addressThunk = (IMAGE_THUNK_DATA*)(base + descriptor->FirstThunk);
+		for (; nameThunk->u1.AddressOfData; ++nameThunk, ++addressThunk)
+		{
+			if (IMAGE_SNAP_BY_ORDINAL(nameThunk->u1.Ordinal))
+			{
+				continue;
+			}
+			const char *const name = (const char*)((const IMAGE_IMPORT_BY_NAME*)(base + nameThunk->u1.AddressOfData))->Name;
+			for (size_t i = 0; i < sizeof(HOOK_FUNCTIONS) / sizeof(HOOK_FUNCTIONS[0]); ++i)
+			{
+				if (!strcmp(name, HOOK_FUNCTIONS[i].name))
+				{
+					patchThunk(addressThunk, HOOK_FUNCTIONS[i].replacement);
+				}
+			}
+		}
+	}
+}
+
+static bool installHooks(void)
+{
+	static HMODULE modules[MAX_MODULES];
+	DWORD bytesNeeded = 0U;
+	if (!EnumProcessModules(GetCurrentProcess(), modules, sizeof(modules), &bytesNeeded))
+	{
+		return false;
+	}
+
+	// The system libraries implement the heap functions, so their own calls are not hooked (neither are the calls of this library)
+	const HMODULE excluded[] = { g_hInstance, GetModuleHandleW(L"ntdll.dll"), GetModuleHandleW(L"kernel32.dll"), GetModuleHandleW(L"kernelbase.dll") };
+	const DWORD moduleCount = (bytesNeeded < sizeof(modules)) ? (bytesNeeded / sizeof(HMODULE)) : MAX_MODULES;
+
+	for (DWORD i = 0; i < moduleCount; ++i)
+	{
+		bool skip = false;
+		for (size_t j = 0; j < sizeof(excluded) / sizeof(excluded[0]); ++j)
+		{
+			if (modules[i] == excluded[j])
+			{
+				skip = true;
+				break;
+			}
+		}
+		if (!skip)
+		{
+			patchModule(modules[i]);
+		}
+	}
+
+	return true;
+}
+
+/* ======================================================================= */
+/* Entry Point                                                             */
+/* ======================================================================= */
+
+static bool attachProcess(void)
+{
+	// The shared section is created by TimedExec, before the library gets injected; if it does not exist, the library has been loaded by someone else
+	wchar_t mappingName[64];
+	swprintf_s(mappingName, 64U, ALLOC_HOOK_MAPPING_NAME, GetCurrentProcessId());
+	const HANDLE hMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, mappingName);
+	if (!hMapping)
+	{
+		return false;
+	}
+
+	g_data = (alloc_hook_data_t*)MapViewOfFile(hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0U, 0U, sizeof(alloc_hook_data_t));
+	CloseHandle(hMapping);
+	if (!g_data)
+	{
+		return false;
+	}
+
+	const HMODULE hKernel32 = GetModuleHandleW(L"kernel32.dll");
+	g_heapAlloc = (HeapAllocFn)GetProcAddress(hKernel32, "HeapAlloc");
+	g_heapReAlloc = (HeapReAllocFn)GetProcAddress(hKernel32, "HeapReAlloc");
+	g_heapFree = (HeapFreeFn)GetProcAddress(hKernel32, "HeapFree");
+
+	// The library must never be unloaded, because the patched import tables keep pointing to the hook functions
+	HMODULE hPinned = NULL;
+	if ((!g_heapAlloc) || (!g_heapReAlloc) || (!g_heapFree) || ((g_tlsIndex = TlsAlloc()) == TLS_OUT_OF_INDEXES) ||
+		(!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_PIN, (LPCWSTR)&attachProcess, &hPinned)))
+	{
+		UnmapViewOfFile(g_data);
+		g_data = NULL;
+		return false;
+	}
+
+	// From here on, the library stays loaded; TimedExec checks the "hooked" flag to find out whether the hooks are in place
+	if (installHooks())
+	{
+		InterlockedExchange(&g_data->hooked, 1L);
+	}
+	return true;
+}
+
+BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
+{
+	UNREFERENCED_PARAMETER(lpvReserved);
+	if (fdwReason == DLL_PROCESS_ATTACH)
+	{
+		g_hInstance = hinstDLL;
+		return attachProcess() ? TRUE : FALSE;
+	}
+
+	// There is nothing to do on DLL_PROCESS_DETACH: The counters are updated in the shared section directly, so they are complete
+	// at any time, including calls from DllMain() of other libraries that are detached after this one, or a TerminateProcess()
+	return TRUE;
+}
@@ -0,0 +1,62 @@
+//////////////////////////////////////////////////////////////////////////////////
+// Timed Exec - Command-Line Benchmarking Utility
+// Copyright (c) 2023 LoRd_MuldeR <mulder2@gmx.de>. Some rights reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// http://www.gnu.org/licenses/gpl-2.0.txt
+//////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _INC_TIMED_EXEC_ALLOC_HOOK_H
+#define _INC_TIMED_EXEC_ALLOC_HOOK_H
+
+/* the hook library is injected into the benchmarked program; it always has the same bitness as TimedExec */
+#ifdef _WIN64
+#  define ALLOC_HOOK_LIBRARY L"TimedExecHook-x64.dll"
+#else
+#  define ALLOC_HOOK_LIBRARY L"TimedExecHook-x86.dll"
+#endif
+
+/* name of the shared section, created by TimedExec for each process (the argument is the process id) */
+#define ALLOC_HOOK_MAPPING_NAME L"Local\\TimedExec.AllocHook.%lu"
+
+/* number of threads that get a counter block of their own, any further threads share the overflow block */
+#define ALLOC_HOOK_MAX_THREADS 64
+
+/* allocation counters of a single thread (padded to a cache line, so that the threads do not share one) */
+typedef struct
+{
+	volatile LONGLONG allocations;
+	volatile LONGLONG reallocations;
+	volatile LONGLONG frees;
+	volatile LONGLONG bytesAllocated;
+	BYTE padding[32];
+}
+alloc_hook_counters_t;
+
+/* layout of the shared section; the counters are updated "live", so they remain valid even if the process gets killed */
+typedef struct
+{
+	volatile LONG hooked;
+	volatile LONG threadCount;
+	BYTE padding[56];
+	volatile LONG_PTR liveBytes;
+	volatile LONG_PTR peakLiveBytes;
+	alloc_hook_counters_t overflow;
+	alloc_hook_counters_t threads[ALLOC_HOOK_MAX_THREADS];
+}
+alloc_hook_data_t;
+
+#endif
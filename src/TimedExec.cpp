@@ -23,17 +23,26 @@
 
 #include <cstdlib>
 #include <vector>
+#include <deque>
 #include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <tchar.h>
 #include <io.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 
 #define NOMINMAX 1
 #define WIN32_LEAN_AND_MEAN 1
 #include <Windows.h>
 #include <ShellAPI.h>
+#include <Sddl.h>
+
+#define PSAPI_VERSION 1
+#include <Psapi.h>
+
+#include "AllocHook.h"
 
 #if _WIN32_WINNT >= 0x0603
 #  include <timeapi.h>
@@ -43,9 +52,38 @@
 
 #define DEFAULT_EXEC_LOOPS 5
 #define DEFAULT_WARMUP_LOOPS 1
+#define DEFAULT_MAX_WARMUP_LOOPS 25
 #define DEFAULT_LOGFILE "TimedExec.log"
 #define ENABLE_ENV_VARS true
 
+#define WARMUP_WINDOW 4
+#define WARMUP_TOLERANCE 0.03
+
+#define MIN_DISTRIBUTION_PASSES 10
+#define HISTOGRAM_MAX_BINS 20
+#define HISTOGRAM_WIDTH 48
+#define DENSITY_GRID_SIZE 256
+
+#define CHECKPOINT_SYNC_PASSES 8
+#define CHECKPOINT_SYNC_SECONDS 60.0
+#define CHECKPOINT_VERSION 3
+
+#define ALLOC_HOOK_TIMEOUT 30000
+
+#define HISTORY_MAGIC "TEXHIST1"
+#define HISTORY_VERSION 1
+#define HISTORY_MIN_SEGMENT 3
+#define HISTORY_MIN_SHIFT 0.02
+#define HISTORY_CHANGE_THRESHOLD 5.0
+#define HISTORY_TOP_REGRESSIONS 10
+#define HISTORY_FLAG_PHASE_TIMES 0x1
+
+#define DEFAULT_PIPE_NAME "\\\\.\\pipe\\TimedExec"
+#define PIPE_BUFFER_SIZE 4096
+#define PIPE_REQUEST_TIMEOUT 10000
+#define PIPE_WRITE_TIMEOUT 60000
+#define PIPE_POLL_INTERVAL 50
+
 #ifdef _UNICODE
 #  define tstring std::wstring
 #else
@@ -55,6 +93,9 @@
 static HANDLE g_hAbortEvent = NULL;
 static volatile bool g_aborted = false;
 
+/* columns of the log file (a new header line is written whenever they change) */
+static const _TCHAR *const LOG_FILE_HEADER = _T("Program\tPasses\tMean Time\tMedian Time\t90% Confidence Interval\t95% Confidence Interval\t99% Confidence Interval\tFastest Pass\tSlowest Pass\tStandard Deviation\tStandard Error\tPeak Memory (MiB)\tPeak Working Set (MiB)\tPage Faults\tOn-CPU Time\tOff-CPU Time\tI/O Transfer (MiB)\tModes\tWarm-Up Passes\tCold Execution Time\tLoader Phase\tRuntime Phase\tTeardown Phase\tStatus\tResumed Passes\tHeap Allocations\tHeap Reallocations\tHeap Frees\tBytes Allocated (MiB)\tPeak Live Heap (MiB)\tCommand Line");
+
 /* clock for time measurement */
 typedef enum
 {
@@ -65,6 +106,142 @@ typedef enum
 }
 clock_type_t;
 
+/* start-up phase breakdown */
+typedef struct
+{
+	double loader;
+	double runtime;
+	double teardown;
+}
+phase_times_t;
+
+/* memory usage counters */
+typedef struct
+{
+	double peakCommit;
+	double peakWorkingSet;
+	double pageFaults;
+}
+memory_counters_t;
+
+/* on-CPU vs. off-CPU time breakdown */
+typedef struct
+{
+	double onCpu;
+	double offCpu;
+	double ioOperations;
+	double ioTransfer;
+}
+cpu_breakdown_t;
+
+/* heap allocation counters */
+typedef struct
+{
+	double allocations;
+	double reallocations;
+	double frees;
+	double bytesAllocated;
+	double peakLiveHeap;
+}
+alloc_counters_t;
+
+/* allocation hook that has been injected into a process */
+typedef struct
+{
+	const _TCHAR *library;
+	HANDLE hMapping;
+	const alloc_hook_data_t *data;
+}
+alloc_hook_t;
+
+/* results of a single metering pass */
+typedef struct
+{
+	double execTime;
+	phase_times_t phases;
+	memory_counters_t memory;
+	cpu_breakdown_t breakdown;
+	alloc_counters_t allocs;
+}
+pass_result_t;
+
+/* mode of a multimodal distribution */
+typedef struct
+{
+	double center;
+	double weight;
+}
+distribution_mode_t;
+
+/* benchmark job of the daemon */
+typedef struct
+{
+	unsigned int id;
+	HANDLE hPipe;
+	HANDLE hToken;
+	bool sameContext;
+	tstring directory;
+	tstring commandLine;
+	std::vector<wchar_t> environment;
+}
+daemon_job_t;
+
+/* header of the history database */
+typedef struct
+{
+	char magic[8];
+	DWORD version;
+	DWORD recordSize;
+	ULONGLONG recordCount;
+	BYTE reserved[40];
+}
+history_header_t;
+
+/* record of the history database (fixed size, so that the file can be memory-mapped as an array) */
+typedef struct
+{
+	ULONGLONG key;
+	ULONGLONG timestamp;
+	double median;
+	double mean;
+	double stddev;
+	double fastest;
+	double slowest;
+	DWORD passes;
+	DWORD clockType;
+	char name[96];
+	char tag[64];
+	DWORD flags;
+	BYTE reserved[28];
+}
+history_record_t;
+
+/* change point in the history of a benchmark */
+typedef struct
+{
+	const history_record_t *before;
+	const history_record_t *after;
+	double meanBefore;
+	double meanAfter;
+	double shift;
+}
+change_point_t;
+
+/* summary statistics */
+typedef struct
+{
+	double mean;
+	double median;
+	double stddev;
+	double fastest;
+	double slowest;
+}
+sample_stats_t;
+
+#ifndef STATUS_WX86_BREAKPOINT
+#  define STATUS_WX86_BREAKPOINT ((DWORD)0x4000001FL)
+#endif
+
 // =============================================================================================================
 // INTERNAL FUNCTIONS
 // =============================================================================================================
@@ -93,6 +270,22 @@ static const char *printClockType(const clock_type_t clock_type)
 	return "N/A";
 }
 
+static double getClockResolution(const clock_type_t clock_type)
+{
+	// The CPU times are accounted in units of the clock interrupt interval (usually 15.625 ms)
+	DWORD timeAdjustment, timeIncrement;
+	BOOL adjustmentDisabled;
+	if (clock_type == CLOCK_WALLCLOCK)
+	{
+		return 0.0;
+	}
+	if (GetSystemTimeAdjustment(&timeAdjustment, &timeIncrement, &adjustmentDisabled) && (timeIncrement > 0U))
+	{
+		return static_cast<double>(timeIncrement) / 10000000.0;
+	}
+	return 0.015625;
+}
+
 static bool setTimerResolution(UINT& period)
 {
 	TIMECAPS timecaps;
@@ -203,6 +396,99 @@ static double getProcessTime(const HANDLE hProc, const clock_type_t clock_type)
 	return static_cast<double>(result) / 10000000.0;
 }
 
+static bool getProcessBreakdown(const HANDLE hProc, cpu_breakdown_t &breakdown)
+{
+	FILETIME timeStart, timeExit, timeKernel, timeUser;
+	IO_COUNTERS ioCounters;
+	breakdown.onCpu = breakdown.offCpu = breakdown.ioOperations = breakdown.ioTransfer = 0.0;
+	if (!GetProcessTimes(hProc, &timeStart, &timeExit, &timeKernel, &timeUser))
+	{
+		return false;
+	}
+	const ULONGLONG wallTime = getTimeElapsed(fileTimeToU64(&timeStart), fileTimeToU64(&timeExit));
+	const ULONGLONG cpuTime = fileTimeToU64(&timeKernel) + fileTimeToU64(&timeUser);
+	breakdown.onCpu = static_cast<double>(cpuTime) / 10000000.0;
+	// For multi-threaded programs, the CPU time can exceed the wall-clock time, so the off-CPU time is unknown (negative)
+	breakdown.offCpu = (cpuTime < wallTime) ? (static_cast<double>(wallTime - cpuTime) / 10000000.0) : -1.0;
+	if (GetProcessIoCounters(hProc, &ioCounters))
+	{
+		breakdown.ioOperations = static_cast<double>(ioCounters.ReadOperationCount + ioCounters.WriteOperationCount + ioCounters.OtherOperationCount);
+		breakdown.ioTransfer = static_cast<double>(ioCounters.ReadTransferCount + ioCounters.WriteTransferCount + ioCounters.OtherTransferCount) / 1048576.0;
+	}
+	return true;
+}
+
+static bool getProcessMemory(const HANDLE hProc, memory_counters_t &counters)
+{
+	PROCESS_MEMORY_COUNTERS memCounters;
+	SecureZeroMemory(&memCounters, sizeof(PROCESS_MEMORY_COUNTERS));
+	counters.peakCommit = counters.peakWorkingSet = counters.pageFaults = 0.0;
+	if (GetProcessMemoryInfo(hProc, &memCounters, sizeof(PROCESS_MEMORY_COUNTERS)))
+	{
+		counters.peakCommit = static_cast<double>(memCounters.PeakPagefileUsage) / 1048576.0;
+		counters.peakWorkingSet = static_cast<double>(memCounters.PeakWorkingSetSize) / 1048576.0;
+		counters.pageFaults = static_cast<double>(memCounters.PageFaultCount);
+		return true;
+	}
+	return false;
+}
+
+static bool getAllocCounters(const alloc_hook_t &allocHook, alloc_counters_t &counters)
+{
+	counters.allocations = counters.reallocations = counters.frees = counters.bytesAllocated = counters.peakLiveHeap = 0.0;
+	if (!(allocHook.data && allocHook.data->hooked))
+	{
+		return false;
+	}
+	// Threads beyond the maximum share the overflow block, so the sum over all blocks is complete
+	const LONG threadCount = std::min(LONG(allocHook.data->threadCount), LONG(ALLOC_HOOK_MAX_THREADS));
+	for (LONG i = -1; i < threadCount; ++i)
+	{
+		const alloc_hook_counters_t &block = (i < 0) ? allocHook.data->overflow : allocHook.data->threads[i];
+		counters.allocations += static_cast<double>(block.allocations);
+		counters.reallocations += static_cast<double>(block.reallocations);
+		counters.frees += static_cast<double>(block.frees);
+		counters.bytesAllocated += static_cast<double>(block.bytesAllocated) / 1048576.0;
+	}
+	counters.peakLiveHeap = static_cast<double>(std::max(LONG_PTR(0), LONG_PTR(allocHook.data->peakLiveBytes))) / 1048576.0;
+	return true;
+}
+
+static void releaseAllocHook(alloc_hook_t &allocHook)
+{
+	if (allocHook.data)
+	{
+		UnmapViewOfFile(allocHook.data);
+		allocHook.data = NULL;
+	}
+	if (allocHook.hMapping)
+	{
+		CloseHandle(allocHook.hMapping);
+		allocHook.hMapping = NULL;
+	}
+}
+
+static LONGLONG getPerfCounter(void)
+{
+	LARGE_INTEGER counter;
+	if (QueryPerformanceCounter(&counter))
+	{
+		return counter.QuadPart;
+	}
+	return 0LL;
+}
+
+static double getPerfCounterElapsed(const LONGLONG timeStart, const LONGLONG timeExit)
+{
+	static LONGLONG frequency = 0LL;
+	if (!frequency)
+	{
+		LARGE_INTEGER temp;
+		frequency = QueryPerformanceFrequency(&temp) ? temp.QuadPart : 1LL;
+	}
+	return (timeExit > timeStart) ? (static_cast<double>(timeExit - timeStart) / static_cast<double>(frequency)) : 0.0;
+}
+
 static long long getCurrentFileSize(FILE *const filePtr)
 {
 	struct _stati64 stats;
@@ -213,6 +499,54 @@ static long long getCurrentFileSize(FILE *const filePtr)
 	return -1;
 }
 
+static bool checkLogHeader(FILE *const filePtr)
+{
+	// Find the most recent header line, because the log file may contain results that were written by an older version; the file is
+	// scanned backwards from the end, because it keeps on growing. Only the beginning of a line is needed to compare it to the header
+	const tstring headerLine(LOG_FILE_HEADER);
+	std::string header, pending;
+	for (tstring::const_iterator iter = headerLine.cbegin(); iter != headerLine.cend(); ++iter)
+	{
+		header.push_back(static_cast<char>(*iter));
+	}
+	const size_t lookAhead = header.size() + 2U;
+	char buffer[4096];
+	bool found = false, match = false;
+	const int previousMode = _setmode(_fileno(filePtr), _O_BINARY);
+	for (long long position = getCurrentFileSize(filePtr); (position > 0) && (!found);)
+	{
+		const size_t count = static_cast<size_t>(std::min<long long>(position, sizeof(buffer)));
+		position -= count;
+		if ((_fseeki64(filePtr, position, SEEK_SET) != 0) || (fread(buffer, 1U, count, filePtr) != count))
+		{
+			break;
+		}
+		const std::string data = std::string(buffer, count) + pending;
+		for (size_t lineStart = count; (lineStart > 0U) || (position == 0); --lineStart)
+		{
+			if (((lineStart == 0U) || (data[lineStart - 1U] == '\n')) && (!data.compare(lineStart, 8U, "Program\t")))
+			{
+				const size_t lineEnd = data.find_first_of("\r\n", lineStart);
+				match = (data.substr(lineStart, (lineEnd != std::string::npos) ? (lineEnd - lineStart) : std::string::npos) == header);
+				found = true;
+				break;
+			}
+			if (lineStart == 0U)
+			{
+				break;
+			}
+		}
+		pending = data.substr(0U, std::min(data.size(), lookAhead));
+	}
+	if (previousMode != -1)
+	{
+		_setmode(_fileno(filePtr), previousMode);
+	}
+	clearerr(filePtr);
+	_fseeki64(filePtr, 0, SEEK_END);
+	return match;
+}
+
 static bool checkBinary(const tstring &filePath)
 {
 	DWORD binaryType;
@@ -241,6 +575,31 @@ static tstring getFullPath(const _TCHAR *const fileName)
 	return tstring(fileName);
 }
 
+static tstring getHookLibraryPath(void)
+{
+	// The hook library is expected in the same directory as the TimedExec executable
+	std::vector<TCHAR> buffer(MAX_PATH);
+	const DWORD length = GetModuleFileName(NULL, buffer.data(), (DWORD)buffer.size());
+	if ((length == 0) || (length >= buffer.size()))
+	{
+		return tstring();
+	}
+	const tstring executablePath(buffer.data(), length);
+	const size_t pos = executablePath.find_last_of(_T("\\/"));
+	return (pos != tstring::npos) ? (executablePath.substr(0, pos + 1U) + ALLOC_HOOK_LIBRARY) : tstring(ALLOC_HOOK_LIBRARY);
+}
+
+static bool checkBinaryBitness(const tstring &filePath)
+{
+	// The hook library can only be injected into a program of the same bitness as TimedExec
+	DWORD binaryType;
+#ifdef _WIN64
+	return GetBinaryType(filePath.c_str(), &binaryType) && (binaryType == SCS_64BIT_BINARY);
+#else
+	return GetBinaryType(filePath.c_str(), &binaryType) && (binaryType == SCS_32BIT_BINARY);
+#endif
+}
+
 static tstring getFileNameOnly(const tstring &filePath)
 {
 	for (tstring::const_reverse_iterator iter = filePath.crbegin(); iter != filePath.crend(); ++iter)
@@ -275,145 +634,1685 @@ static double computeMedian(std::vector<double> &data)
 		: data[center];
 }
 
-static void appendStr(tstring &commandLine, const tstring &token)
+static void computeStatistics(const std::vector<double> &data, sample_stats_t &stats)
 {
-	for (tstring::const_iterator iter = token.cbegin(); iter != token.cend(); ++iter)
+	stats.mean = stats.median = stats.stddev = stats.fastest = stats.slowest = 0.0;
+	if (data.empty())
 	{
-		if (*iter)
-		{
-			if (*iter == _T('"'))
-			{
-				commandLine += _T('\\');
-			}
-			commandLine += *iter;
-		}
-		else
+		return;
+	}
+
+	std::vector<double> sorted(data);
+	stats.median = computeMedian(sorted);
+	stats.fastest = sorted.front();
+	stats.slowest = sorted.back();
+
+	double variance = 0.0;
+	for (size_t i = 0; i < data.size(); ++i)
+	{
+		const double delta = data[i] - stats.mean;
+		stats.mean += delta / ((double)(i + 1U));
+		variance += delta * (data[i] - stats.mean);
+	}
+
+	stats.stddev = (data.size() > 1U) ? sqrt(variance / ((double)(data.size() - 1U))) : 0.0;
+}
+
+static double computeBandwidth(const std::vector<double> &sorted, const double stddev)
+{
+	// Silverman's "rule of thumb", using the IQR in order to avoid oversmoothing of multimodal data
+	const size_t size = sorted.size();
+	const double iqr = (sorted[(3U * size) / 4U] - sorted[size / 4U]) / 1.34;
+	const double spread = ((iqr > 0.0) && (iqr < stddev)) ? iqr : stddev;
+	const double bandwidth = 0.9 * spread * pow((double)size, -0.2);
+	return (bandwidth > 0.0) ? bandwidth : 1e-9;
+}
+
+static double computeDensity(const std::vector<double> &data, const double bandwidth, const double x)
+{
+	static const double INV_SQRT_2PI = 0.39894228040143267794;
+	double sum = 0.0;
+	for (std::vector<double>::const_iterator iter = data.cbegin(); iter != data.cend(); ++iter)
+	{
+		const double u = (x - (*iter)) / bandwidth;
+		sum += exp(-0.5 * u * u);
+	}
+	return (INV_SQRT_2PI * sum) / (((double)data.size()) * bandwidth);
+}
+
+static void computeSegments(const std::vector<double> &sorted, const double lower, const double step, const std::vector<size_t> &valleys, std::vector<distribution_mode_t> &modes)
+{
+	modes.clear();
+	size_t first = 0;
+	for (size_t segment = 0; segment <= valleys.size(); ++segment)
+	{
+		size_t last = first;
+		while ((last < sorted.size()) && ((segment >= valleys.size()) || (sorted[last] <= lower + (((double)valleys[segment]) * step)))) ++last;
+		if (last > first)
 		{
-			break;
+			std::vector<double> part(sorted.begin() + first, sorted.begin() + last);
+			distribution_mode_t mode = { computeMedian(part), ((double)(last - first)) / ((double)sorted.size()) };
+			modes.push_back(mode);
 		}
+		first = last;
 	}
 }
 
-static int initializeCommandLine(tstring &commandLine, tstring &programFile)
+static void computeModes(const std::vector<double> &sorted, const double bandwidth, const double resolution, std::vector<distribution_mode_t> &modes)
 {
-	commandLine.clear();
-	programFile.clear();
-
-	int nArgs = 0;
-	TCHAR **szArglist = CommandLineToArgvW(GetCommandLineW(), &nArgs);
+	modes.clear();
+	const double lower = sorted.front() - 3.0 * bandwidth, upper = sorted.back() + 3.0 * bandwidth;
+	const double step = (upper - lower) / ((double)(DENSITY_GRID_SIZE - 1));
 
-	if ((szArglist == NULL) || (nArgs < 2))
+	// Evaluate the kernel density estimate on a regular grid
+	std::vector<double> density(DENSITY_GRID_SIZE);
+	for (size_t i = 0; i < DENSITY_GRID_SIZE; ++i)
 	{
-		return 0;
+		density[i] = computeDensity(sorted, bandwidth, lower + (((double)i) * step));
 	}
 
-	for(int i = 1; i < nArgs; i++)
+	// Find the local maxima of the density estimate
+	std::vector<size_t> peaks;
+	for (size_t i = 1; i < DENSITY_GRID_SIZE - 1U; ++i)
 	{
-		tstring token;
-		if (i > 1)
+		if ((density[i] > density[i - 1U]) && (density[i] >= density[i + 1U]))
 		{
-			token = tstring(szArglist[i]);
-			commandLine += _T(' ');
+			peaks.push_back(i);
 		}
-		else
+	}
+
+	// Merge peaks that are not separated by a significant "valley"
+	std::vector<size_t> valleys;
+	for (size_t i = 1; i < peaks.size(); ++i)
+	{
+		const size_t valley = std::min_element(density.begin() + peaks[i - 1U], density.begin() + peaks[i]) - density.begin();
+		if (density[valley] > 0.7 * std::min(density[peaks[i - 1U]], density[peaks[i]]))
 		{
-			token = getFullPath(szArglist[i]);
-			programFile = token;
+			if (density[peaks[i]] < density[peaks[i - 1U]]) peaks[i] = peaks[i - 1U];
+			peaks.erase(peaks.begin() + (i - 1U));
+			valleys.clear(); i = 0; /*restart*/
+			continue;
 		}
-		if (token.find(_T(' ')) == tstring::npos)
+		valleys.push_back(valley);
+	}
+
+	// Split the samples at the valleys and drop modes that contain too few samples
+	const size_t minCount = std::max<size_t>(2U, sorted.size() / 10U);
+	for (;;)
+	{
+		std::vector<size_t> counts(valleys.size() + 1U, 0U);
+		size_t segment = 0;
+		for (size_t i = 0; i < sorted.size(); ++i)
 		{
-			appendStr(commandLine, token);
+			while ((segment < valleys.size()) && (sorted[i] > lower + (((double)valleys[segment]) * step))) ++segment;
+			++counts[segment];
 		}
-		else
+		const std::vector<size_t>::const_iterator smallest = std::min_element(counts.cbegin(), counts.cend());
+		if ((valleys.empty()) || (*smallest >= minCount))
 		{
-			commandLine += _T('"');
-			appendStr(commandLine, token);
-			commandLine += _T('"');
+			break;
 		}
+		const size_t index = smallest - counts.cbegin();
+		valleys.erase(valleys.begin() + ((index < valleys.size()) ? index : (index - 1U)));
 	}
 
-	LocalFree(szArglist);
-	return nArgs;
+	// Compute center and weight of each mode, merging modes that are not further apart than the resolution of the clock
+	for (;;)
+	{
+		computeSegments(sorted, lower, step, valleys, modes);
+		size_t index = 1U;
+		while ((index < modes.size()) && (modes[index].center - modes[index - 1U].center > resolution)) ++index;
+		if (index >= modes.size())
+		{
+			break;
+		}
+		valleys.erase(valleys.begin() + (index - 1U));
+	}
 }
 
-static bool createProcess(const tstring &commandLine, HANDLE &hThrd, HANDLE &hProc, const bool highPriority = false)
+static void printHistogram(const std::vector<double> &sorted, const double bandwidth)
 {
-	STARTUPINFO startInfo;
-	SecureZeroMemory(&startInfo, sizeof(STARTUPINFO));
-	PROCESS_INFORMATION processInfo;
-	SecureZeroMemory(&processInfo, sizeof(PROCESS_INFORMATION));
+	const size_t size = sorted.size();
+	const size_t bins = std::min<size_t>(HISTOGRAM_MAX_BINS, std::max<size_t>(5U, (size_t)ceil(sqrt((double)size))));
+	const double lower = sorted.front(), width = std::max(sorted.back() - sorted.front(), 1e-9) / ((double)bins);
 
-	if (!CreateProcess(NULL, (LPTSTR)commandLine.c_str(), NULL, NULL, false, highPriority ? HIGH_PRIORITY_CLASS : 0U, NULL, NULL, &startInfo, &processInfo))
+	std::vector<size_t> counts(bins, 0U);
+	for (std::vector<double>::const_iterator iter = sorted.cbegin(); iter != sorted.cend(); ++iter)
 	{
-		return false;
+		++counts[std::min(bins - 1U, (size_t)(((*iter) - lower) / width))];
 	}
 
-	hThrd = processInfo.hThread;
-	hProc = processInfo.hProcess;
+	// Expected count per bin, according to the kernel density estimate
+	std::vector<double> expected(bins);
+	for (size_t i = 0; i < bins; ++i)
+	{
+		expected[i] = computeDensity(sorted, bandwidth, lower + ((((double)i) + 0.5) * width)) * ((double)size) * width;
+	}
 
-	return true;
+	const double scale = ((double)HISTOGRAM_WIDTH) / std::max((double)(*std::max_element(counts.cbegin(), counts.cend())), *std::max_element(expected.cbegin(), expected.cend()));
+	for (size_t i = 0; i < bins; ++i)
+	{
+		std::string bar((size_t)((((double)counts[i]) * scale) + 0.5), '#');
+		const size_t marker = std::min<size_t>(HISTOGRAM_WIDTH, (size_t)((expected[i] * scale) + 0.5));
+		if (bar.size() <= marker) bar.resize(marker + 1U, ' ');
+		bar[marker] = '*';
+		std::cerr << '[' << std::setw(9) << (lower + (((double)i) * width)) << ", " << std::setw(9) << (lower + (((double)(i + 1U)) * width)) << ") " << std::setw(4) << counts[i] << " |" << bar << std::endl;
+	}
 }
 
-static bool waitForProcess(const HANDLE &hProc)
+static bool checkSteadyState(const std::vector<double> &samples, const clock_type_t clock_type)
 {
-	HANDLE waitHandles[2] = {hProc, g_hAbortEvent};
-	const DWORD ret = WaitForMultipleObjects(2, &waitHandles[0], FALSE, INFINITE);
-	if ((ret != WAIT_OBJECT_0) && (ret != WAIT_OBJECT_0 + 1))
+	if (samples.size() < WARMUP_WINDOW)
 	{
 		return false;
 	}
-	if (ret > WAIT_OBJECT_0)
+
+	// The range (slowest minus fastest) of the last passes must not exceed the tolerance, relative to their median...
+	const std::vector<double> recent(samples.end() - WARMUP_WINDOW, samples.end());
+	std::vector<double> sorted(recent);
+	const double median = computeMedian(sorted);
+	// The CPU times are quantized to clock ticks, so a short program may never get any closer than a single tick
+	const double resolution = getClockResolution(clock_type);
+	if ((sorted.back() - sorted.front()) > std::max(WARMUP_TOLERANCE * median, resolution))
 	{
-		g_aborted = true;
+		return false;
 	}
-	return true;
+
+	// ...and the drift of the trend (least-squares slope) over the last passes must not exceed half of the tolerance
+	const double centerX = (WARMUP_WINDOW - 1) / 2.0;
+	double meanY = 0.0, sumXY = 0.0, sumXX = 0.0;
+	for (size_t i = 0; i < WARMUP_WINDOW; ++i)
+	{
+		meanY += recent[i] / WARMUP_WINDOW;
+	}
+	for (size_t i = 0; i < WARMUP_WINDOW; ++i)
+	{
+		sumXY += (i - centerX) * (recent[i] - meanY);
+		sumXX += (i - centerX) * (i - centerX);
+	}
+	return (fabs(sumXY / sumXX) * (WARMUP_WINDOW - 1)) <= std::max(0.5 * WARMUP_TOLERANCE * median, resolution);
 }
 
-static int getProcessExitCode(const HANDLE &hProc)
+static ULONGLONG hashString(const tstring &str)
 {
-	DWORD exitCode;
-	if (GetExitCodeProcess(hProc, &exitCode))
+	// 64-Bit FNV-1a hash function
+	ULONGLONG hash = 0xCBF29CE484222325ULL;
+	for (tstring::const_iterator iter = str.cbegin(); iter != str.cend(); ++iter)
 	{
-		return *reinterpret_cast<int*>(&exitCode);
+		hash = (hash ^ static_cast<ULONGLONG>(*iter)) * 0x100000001B3ULL;
 	}
-	return -1;
+	return hash;
 }
 
-static void abortedHandlerRoutine(const HANDLE &hProc)
+static bool readCheckpoint(const tstring &fileName, const char *const header, const size_t maxRecords, std::vector<pass_result_t> &results, long long &validSize)
 {
-	TerminateProcess(hProc, UINT(-1));
-	WaitForSingleObject(hProc, INFINITE);
-	std::cerr << std::endl;
-	std::cerr << "\n===============================================================================" << std::endl;
-	std::cerr << "ABORTED BY USER !!!" << std::endl;
-	std::cerr << "===============================================================================\n" << std::endl;
+	FILE *file = NULL;
+	results.clear();
+	validSize = -1LL;
+	if (_tfopen_s(&file, fileName.c_str(), _T("r")) != 0)
+	{
+		return false;
+	}
+
+	// Remember where the last complete record ends, so that an incomplete record can be cut off when the file is resumed
+	char line[512];
+	const bool valid = (fgets(line, sizeof(line), file) != NULL) && (!strcmp(line, header)) && ((validSize = _ftelli64(file)) >= 0LL);
+	while (valid && (results.size() < maxRecords) && fgets(line, sizeof(line), file))
+	{
+		pass_result_t result;
+		if ((!strchr(line, '\n')) || (sscanf_s(line, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf", &result.execTime, &result.phases.loader, &result.phases.runtime, &result.phases.teardown,
+			&result.memory.peakCommit, &result.memory.peakWorkingSet, &result.memory.pageFaults, &result.breakdown.onCpu, &result.breakdown.offCpu,
+			&result.breakdown.ioOperations, &result.breakdown.ioTransfer, &result.allocs.allocations, &result.allocs.reallocations, &result.allocs.frees,
+			&result.allocs.bytesAllocated, &result.allocs.peakLiveHeap) != 16))
+		{
+			break; /*incomplete record*/
+		}
+		results.push_back(result);
+		validSize = _ftelli64(file);
+	}
+
+	fclose(file);
+	return valid;
 }
 
-static void invalidParameterHandler(const wchar_t*, const wchar_t*, const wchar_t*, unsigned int, uintptr_t)
+static bool writeCheckpoint(FILE *const file, const pass_result_t &result)
 {
-	std::cerr << std::endl;
-	std::cerr << "\n===============================================================================" << std::endl;
-	std::cerr << "GURU MEDITATION: Invalid Parameter Handler Invoked!" << std::endl;
-	std::cerr << "===============================================================================\n" << std::endl;
-	_exit(-1);
+	fprintf(file, "%.9f\t%.9f\t%.9f\t%.9f\t%.6f\t%.6f\t%.0f\t%.9f\t%.9f\t%.0f\t%.6f\t%.0f\t%.0f\t%.0f\t%.6f\t%.6f\n", result.execTime, result.phases.loader, result.phases.runtime, result.phases.teardown,
+		result.memory.peakCommit, result.memory.peakWorkingSet, result.memory.pageFaults, result.breakdown.onCpu, result.breakdown.offCpu,
+		result.breakdown.ioOperations, result.breakdown.ioTransfer, result.allocs.allocations, result.allocs.reallocations, result.allocs.frees,
+		result.allocs.bytesAllocated, result.allocs.peakLiveHeap);
+	return (fflush(file) == 0) && (ferror(file) == 0);
 }
 
-static BOOL WINAPI ctrlHandlerRoutine(DWORD dwCtrlType)
+static bool syncCheckpoint(FILE *const file)
 {
-	g_aborted = true;
-	SetEvent(g_hAbortEvent);
-	return TRUE;
+	return (_commit(_fileno(file)) == 0);
 }
 
-static LONG WINAPI crashHandlerRoutine(struct _EXCEPTION_POINTERS *ExceptionInfo)
+static FILE *createCheckpoint(const tstring &fileName, const char *const header, const long long validSize)
 {
-	static const char *const message = "\n\nGURU MEDITATION: UNHANDELED SYSTEM EXCEPTION !!!\n\n";
-	DWORD bytesWritten;
-	WriteFile(GetStdHandle(STD_ERROR_HANDLE), message, lstrlenA(message), &bytesWritten, NULL);
+	FILE *file = NULL;
+	if (_tfopen_s(&file, fileName.c_str(), (validSize < 0LL) ? _T("wN") : _T("r+N")) != 0)
+	{
+		return NULL;
+	}
+
+	// A resumed file is never re-written, because a crash in the meantime would lose all records; only the incomplete record at the end (if any) is cut off
+	if (validSize < 0LL)
+	{
+		fputs(header, file);
+	}
+	else if ((_chsize_s(_fileno(file), validSize) != 0) || (_fseeki64(file, 0, SEEK_END) != 0))
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	if ((fflush(file) != 0) || (ferror(file) != 0) || (!syncCheckpoint(file)))
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	return file;
+}
+
+static tstring formatValue(const double value, const bool valid)
+{
+	_TCHAR buffer[32] = _T("N/A");
+	if (valid)
+	{
+		_stprintf_s(buffer, 32U, _T("%f"), value);
+	}
+	return tstring(buffer);
+}
+
+static std::string toUtf8(const tstring &str)
+{
+	const int length = WideCharToMultiByte(CP_UTF8, 0, str.c_str(), (int)str.size(), NULL, 0, NULL, NULL);
+	if (length > 0)
+	{
+		std::vector<char> buffer(length);
+		if (WideCharToMultiByte(CP_UTF8, 0, str.c_str(), (int)str.size(), buffer.data(), length, NULL, NULL) == length)
+		{
+			return std::string(buffer.begin(), buffer.end());
+		}
+	}
+	return std::string();
+}
+
+static tstring fromUtf8(const std::string &str)
+{
+	const int length = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), NULL, 0);
+	if (length > 0)
+	{
+		std::vector<wchar_t> buffer(length);
+		if (MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), buffer.data(), length) == length)
+		{
+			return tstring(buffer.begin(), buffer.end());
+		}
+	}
+	return tstring();
+}
+
+static void appendStr(tstring &commandLine, const tstring &token)
+{
+	for (tstring::const_iterator iter = token.cbegin(); iter != token.cend(); ++iter)
+	{
+		if (*iter)
+		{
+			if (*iter == _T('"'))
+			{
+				commandLine += _T('\\');
+			}
+			commandLine += *iter;
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+static int initializeCommandLine(tstring &commandLine, tstring &programFile)
+{
+	commandLine.clear();
+	programFile.clear();
+
+	int nArgs = 0;
+	TCHAR **szArglist = CommandLineToArgvW(GetCommandLineW(), &nArgs);
+
+	if ((szArglist == NULL) || (nArgs < 2))
+	{
+		return 0;
+	}
+
+	for(int i = 1; i < nArgs; i++)
+	{
+		tstring token;
+		if (i > 1)
+		{
+			token = tstring(szArglist[i]);
+			commandLine += _T(' ');
+		}
+		else
+		{
+			token = getFullPath(szArglist[i]);
+			programFile = token;
+		}
+		if (token.find(_T(' ')) == tstring::npos)
+		{
+			appendStr(commandLine, token);
+		}
+		else
+		{
+			commandLine += _T('"');
+			appendStr(commandLine, token);
+			commandLine += _T('"');
+		}
+	}
+
+	LocalFree(szArglist);
+	return nArgs;
+}
+
+static bool injectAllocHook(const HANDLE hProc, const DWORD processId, alloc_hook_t &allocHook)
+{
+	// The shared section has to exist before the library gets loaded; a new section is always zero-initialized
+	wchar_t mappingName[64];
+	swprintf_s(mappingName, 64U, ALLOC_HOOK_MAPPING_NAME, processId);
+	if (!(allocHook.hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0U, sizeof(alloc_hook_data_t), mappingName)))
+	{
+		return false;
+	}
+	if ((GetLastError() == ERROR_ALREADY_EXISTS) || (!(allocHook.data = (const alloc_hook_data_t*)MapViewOfFile(allocHook.hMapping, FILE_MAP_READ, 0U, 0U, sizeof(alloc_hook_data_t)))))
+	{
+		releaseAllocHook(allocHook);
+		return false;
+	}
+
+	// The library is loaded by a remote thread that calls LoadLibraryW(), which is at the same address in all processes of the same bitness
+	const LPTHREAD_START_ROUTINE loadLibrary = (LPTHREAD_START_ROUTINE)GetProcAddress(GetModuleHandle(_T("kernel32.dll")), "LoadLibraryW");
+	const SIZE_T size = (_tcslen(allocHook.library) + 1U) * sizeof(_TCHAR);
+	const LPVOID remoteName = loadLibrary ? VirtualAllocEx(hProc, NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE) : NULL;
+	if (!remoteName)
+	{
+		releaseAllocHook(allocHook);
+		return false;
+	}
+
+	bool success = false;
+	SIZE_T bytesTransferred;
+	if (WriteProcessMemory(hProc, remoteName, allocHook.library, size, &bytesTransferred) && (bytesTransferred == size))
+	{
+		const HANDLE hThread = CreateRemoteThread(hProc, NULL, 0U, loadLibrary, remoteName, 0U, NULL);
+		if (hThread)
+		{
+			// The exit code of the thread is a truncated module handle, so only the flag that is set by the library is reliable
+			success = (WaitForSingleObject(hThread, ALLOC_HOOK_TIMEOUT) == WAIT_OBJECT_0) && (allocHook.data->hooked != 0L);
+			CloseHandle(hThread);
+		}
+	}
+
+	if (!success)
+	{
+		releaseAllocHook(allocHook);
+		return false; /*the process is going to be terminated, so the remote memory does not need to be freed*/
+	}
+
+	VirtualFreeEx(hProc, remoteName, 0U, MEM_RELEASE);
+	return true;
+}
+
+static bool isRedirected(const HANDLE hStdHandle)
+{
+	DWORD mode;
+	return (hStdHandle != NULL) && (hStdHandle != INVALID_HANDLE_VALUE) && (!GetConsoleMode(hStdHandle, &mode));
+}
+
+static bool createProcess(const tstring &commandLine, HANDLE &hThrd, HANDLE &hProc, const bool highPriority = false, const bool debugProcess = false, alloc_hook_t *const allocHook = NULL)
+{
+	STARTUPINFO startInfo;
+	SecureZeroMemory(&startInfo, sizeof(STARTUPINFO));
+	startInfo.cb = sizeof(STARTUPINFO);
+	PROCESS_INFORMATION processInfo;
+	SecureZeroMemory(&processInfo, sizeof(PROCESS_INFORMATION));
+
+	// The console is shared with the program anyway, but redirected handles (e.g. a file, or the pipe of a daemon job) have to be passed on explicitly
+	startInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+	startInfo.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+	startInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+	const bool redirected = isRedirected(startInfo.hStdInput) || isRedirected(startInfo.hStdOutput) || isRedirected(startInfo.hStdError);
+	if (redirected)
+	{
+		startInfo.dwFlags = STARTF_USESTDHANDLES;
+	}
+
+	if (!CreateProcess(NULL, (LPTSTR)commandLine.c_str(), NULL, NULL, redirected, (highPriority ? HIGH_PRIORITY_CLASS : 0U) | (debugProcess ? DEBUG_ONLY_THIS_PROCESS : 0U) | (allocHook ? CREATE_SUSPENDED : 0U), NULL, NULL, &startInfo, &processInfo))
+	{
+		return false;
+	}
+
+	// The allocation hook is injected while the process is still suspended, so the hooks are in place before the program's entry point runs
+	if (allocHook)
+	{
+		if (!injectAllocHook(processInfo.hProcess, processInfo.dwProcessId, *allocHook))
+		{
+			TerminateProcess(processInfo.hProcess, 1U);
+			CloseHandle(processInfo.hThread);
+			CloseHandle(processInfo.hProcess);
+			return false;
+		}
+		ResumeThread(processInfo.hThread);
+	}
+
+	hThrd = processInfo.hThread;
+	hProc = processInfo.hProcess;
+
+	return true;
+}
+
+static bool waitForProcess(const HANDLE &hProc)
+{
+	HANDLE waitHandles[2] = {hProc, g_hAbortEvent};
+	const DWORD ret = WaitForMultipleObjects(2, &waitHandles[0], FALSE, INFINITE);
+	if ((ret != WAIT_OBJECT_0) && (ret != WAIT_OBJECT_0 + 1))
+	{
+		return false;
+	}
+	if (ret > WAIT_OBJECT_0)
+	{
+		g_aborted = true;
+	}
+	return true;
+}
+
+static bool setInstructionPointer(const DWORD threadId, const ULONG_PTR address, const bool wow64Context)
+{
+	const HANDLE hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, threadId);
+	bool success = false;
+	if (!hThread)
+	{
+		return false;
+	}
+#ifdef _WIN64
+	if (wow64Context)
+	{
+		typedef BOOL (WINAPI *Wow64ThreadContextFn)(HANDLE, PWOW64_CONTEXT);
+		const HMODULE hKernel32 = GetModuleHandle(_T("kernel32.dll"));
+		const Wow64ThreadContextFn wow64GetThreadContext = (Wow64ThreadContextFn)GetProcAddress(hKernel32, "Wow64GetThreadContext");
+		const Wow64ThreadContextFn wow64SetThreadContext = (Wow64ThreadContextFn)GetProcAddress(hKernel32, "Wow64SetThreadContext");
+		WOW64_CONTEXT context;
+		SecureZeroMemory(&context, sizeof(WOW64_CONTEXT));
+		context.ContextFlags = WOW64_CONTEXT_CONTROL;
+		if (wow64GetThreadContext && wow64SetThreadContext && wow64GetThreadContext(hThread, &context))
+		{
+			context.Eip = (DWORD)address;
+			success = wow64SetThreadContext(hThread, &context) ? true : false;
+		}
+		CloseHandle(hThread);
+		return success;
+	}
+#endif
+	CONTEXT context;
+	SecureZeroMemory(&context, sizeof(CONTEXT));
+	context.ContextFlags = CONTEXT_CONTROL;
+	if (GetThreadContext(hThread, &context))
+	{
+#ifdef _WIN64
+		context.Rip = address;
+#else
+		context.Eip = address;
+#endif
+		success = SetThreadContext(hThread, &context) ? true : false;
+	}
+	CloseHandle(hThread);
+	return success;
+}
+
+static bool canRestoreBreakpoints(const HANDLE hProc, bool &wow64Process)
+{
+	wow64Process = false;
+#ifdef _WIN64
+	BOOL isWow64 = FALSE;
+	// Restoring the instruction pointer of a WOW64 process requires Wow64SetThreadContext(), which is available since Windows Vista
+	if (IsWow64Process(hProc, &isWow64) && isWow64)
+	{
+		if (!GetProcAddress(GetModuleHandle(_T("kernel32.dll")), "Wow64SetThreadContext"))
+		{
+			return false;
+		}
+		wow64Process = true;
+	}
+#else
+	UNREFERENCED_PARAMETER(hProc);
+#endif
+	return true;
+}
+
+static bool setBreakpoint(const HANDLE hProc, const ULONG_PTR address, BYTE &originalByte)
+{
+	static const BYTE INT3 = 0xCC;
+	SIZE_T bytesTransferred;
+	if (ReadProcessMemory(hProc, (LPCVOID)address, &originalByte, 1U, &bytesTransferred) && (bytesTransferred == 1U))
+	{
+		if (WriteProcessMemory(hProc, (LPVOID)address, &INT3, 1U, &bytesTransferred) && (bytesTransferred == 1U))
+		{
+			FlushInstructionCache(hProc, (LPCVOID)address, 1U);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void clearBreakpoint(const HANDLE hProc, const DWORD threadId, const ULONG_PTR address, const BYTE originalByte, const bool wow64Context)
+{
+	// Restore the original instruction and resume execution at the address of the breakpoint
+	SIZE_T bytesWritten;
+	WriteProcessMemory(hProc, (LPVOID)address, &originalByte, 1U, &bytesWritten);
+	FlushInstructionCache(hProc, (LPCVOID)address, 1U);
+	setInstructionPointer(threadId, address, wow64Context);
+}
+
+static ULONG_PTR getExitAddress(void)
+{
+	// System DLLs are mapped at the same base address in all processes (of the same bitness), so the address is valid in the debuggee too
+	const FARPROC exitFunction = GetProcAddress(GetModuleHandle(_T("ntdll.dll")), "RtlExitUserProcess");
+	return exitFunction ? (ULONG_PTR)exitFunction : (ULONG_PTR)GetProcAddress(GetModuleHandle(_T("kernel32.dll")), "ExitProcess");
+}
+
+static bool waitForProcessPhases(const HANDLE &hProc, const LONGLONG timeStart, phase_times_t &phases)
+{
+	LONGLONG timeLoader = 0LL, timeEntry = 0LL, timeTeardown = 0LL;
+	bool loaderBreak = false, wow64Break = false, entryBreak = false, exitBreak = false, wow64Process = false;
+	ULONG_PTR entryAddress = 0U, exitAddress = 0U;
+	BYTE entryByte = 0U, exitByte = 0U;
+	phases.loader = phases.runtime = 0.0;
+	phases.teardown = -1.0;
+
+	for (;;)
+	{
+		if (g_aborted)
+		{
+			DebugActiveProcessStop(GetProcessId(hProc));
+			return true;
+		}
+
+		DEBUG_EVENT debugEvent;
+		if (!WaitForDebugEvent(&debugEvent, 100U))
+		{
+			if (GetLastError() == ERROR_SEM_TIMEOUT)
+			{
+				continue;
+			}
+			return false;
+		}
+
+		const LONGLONG timeNow = getPerfCounter();
+		DWORD continueStatus = DBG_CONTINUE;
+
+		switch (debugEvent.dwDebugEventCode)
+		{
+		case CREATE_PROCESS_DEBUG_EVENT:
+			// A one-shot breakpoint at the entry point of the executable marks the end of the loader phase, i.e. *after* all DLL initializers and TLS callbacks have run,
+			// and a one-shot breakpoint at RtlExitUserProcess() marks the beginning of the teardown phase (not available for WOW64 processes, because of the different NTDLL)
+			if (canRestoreBreakpoints(hProc, wow64Process))
+			{
+				if (debugEvent.u.CreateProcessInfo.lpStartAddress)
+				{
+					entryAddress = (ULONG_PTR)debugEvent.u.CreateProcessInfo.lpStartAddress;
+					entryBreak = setBreakpoint(hProc, entryAddress, entryByte);
+				}
+				if ((!wow64Process) && (exitAddress = getExitAddress()))
+				{
+					exitBreak = setBreakpoint(hProc, exitAddress, exitByte);
+				}
+			}
+			if (debugEvent.u.CreateProcessInfo.hFile) CloseHandle(debugEvent.u.CreateProcessInfo.hFile);
+			break;
+		case LOAD_DLL_DEBUG_EVENT:
+			if (debugEvent.u.LoadDll.hFile) CloseHandle(debugEvent.u.LoadDll.hFile);
+			break;
+		case EXCEPTION_DEBUG_EVENT:
+			{
+				const DWORD exceptionCode = debugEvent.u.Exception.ExceptionRecord.ExceptionCode;
+				const ULONG_PTR exceptionAddress = (ULONG_PTR)debugEvent.u.Exception.ExceptionRecord.ExceptionAddress;
+				const bool isBreakpoint = (exceptionCode == EXCEPTION_BREAKPOINT) || (exceptionCode == STATUS_WX86_BREAKPOINT);
+				if (isBreakpoint && entryBreak && (exceptionAddress == entryAddress))
+				{
+					clearBreakpoint(hProc, debugEvent.dwThreadId, entryAddress, entryByte, wow64Process && (exceptionCode == STATUS_WX86_BREAKPOINT));
+					if (!timeEntry) timeEntry = timeNow;
+				}
+				else if (isBreakpoint && exitBreak && (exceptionAddress == exitAddress))
+				{
+					clearBreakpoint(hProc, debugEvent.dwThreadId, exitAddress, exitByte, false);
+					if (!timeTeardown) timeTeardown = timeNow;
+				}
+				else if ((exceptionCode == EXCEPTION_BREAKPOINT) && (!loaderBreak))
+				{
+					// The system breakpoint is raised by the loader once the static imports have been mapped (WOW64 processes raise a second one)
+					loaderBreak = true;
+					timeLoader = timeNow;
+				}
+				else if ((exceptionCode == STATUS_WX86_BREAKPOINT) && (!wow64Break))
+				{
+					wow64Break = true;
+					timeLoader = timeNow;
+				}
+				else
+				{
+					continueStatus = DBG_EXCEPTION_NOT_HANDLED;
+				}
+			}
+			break;
+		case EXIT_PROCESS_DEBUG_EVENT:
+			if (timeEntry)
+			{
+				timeLoader = timeEntry;
+			}
+			if (!timeLoader)
+			{
+				timeLoader = timeNow;
+			}
+			phases.loader = getPerfCounterElapsed(timeStart, timeLoader);
+			if (timeTeardown)
+			{
+				// The teardown phase is unknown (negative), if the process did not exit via RtlExitUserProcess(), e.g. because it has been terminated
+				phases.runtime = getPerfCounterElapsed(timeLoader, timeTeardown);
+				phases.teardown = getPerfCounterElapsed(timeTeardown, timeNow);
+			}
+			else
+			{
+				phases.runtime = getPerfCounterElapsed(timeLoader, timeNow);
+			}
+			ContinueDebugEvent(debugEvent.dwProcessId, debugEvent.dwThreadId, DBG_CONTINUE);
+			return (WaitForSingleObject(hProc, INFINITE) == WAIT_OBJECT_0);
+		}
+
+		ContinueDebugEvent(debugEvent.dwProcessId, debugEvent.dwThreadId, continueStatus);
+	}
+}
+
+static int getProcessExitCode(const HANDLE &hProc)
+{
+	DWORD exitCode;
+	if (GetExitCodeProcess(hProc, &exitCode))
+	{
+		return *reinterpret_cast<int*>(&exitCode);
+	}
+	return -1;
+}
+
+static void abortedHandlerRoutine(const HANDLE &hProc)
+{
+	TerminateProcess(hProc, UINT(-1));
+	WaitForSingleObject(hProc, INFINITE);
+	std::cerr << std::endl;
+	std::cerr << "\n===============================================================================" << std::endl;
+	std::cerr << "ABORTED BY USER !!!" << std::endl;
+	std::cerr << "===============================================================================\n" << std::endl;
+}
+
+static void invalidParameterHandler(const wchar_t*, const wchar_t*, const wchar_t*, unsigned int, uintptr_t)
+{
+	std::cerr << std::endl;
+	std::cerr << "\n===============================================================================" << std::endl;
+	std::cerr << "GURU MEDITATION: Invalid Parameter Handler Invoked!" << std::endl;
+	std::cerr << "===============================================================================\n" << std::endl;
+	_exit(-1);
+}
+
+static BOOL WINAPI ctrlHandlerRoutine(DWORD dwCtrlType)
+{
+	g_aborted = true;
+	SetEvent(g_hAbortEvent);
+	return TRUE;
+}
+
+static LONG WINAPI crashHandlerRoutine(struct _EXCEPTION_POINTERS *ExceptionInfo)
+{
+	static const char *const message = "\n\nGURU MEDITATION: UNHANDELED SYSTEM EXCEPTION !!!\n\n";
+	DWORD bytesWritten;
+	WriteFile(GetStdHandle(STD_ERROR_HANDLE), message, lstrlenA(message), &bytesWritten, NULL);
 	TerminateProcess(GetCurrentProcess(), UINT(-1));
 	return EXCEPTION_EXECUTE_HANDLER;
 }
 
+// =============================================================================================================
+// HISTORY DATABASE
+// =============================================================================================================
+
+static bool checkHistoryHeader(const history_header_t &header)
+{
+	return (!memcmp(header.magic, HISTORY_MAGIC, sizeof(header.magic))) && (header.version == HISTORY_VERSION) && (header.recordSize == sizeof(history_record_t));
+}
+
+static void initHistoryRecord(history_record_t &record, const tstring &name, const tstring &tag, const clock_type_t clock_type, const bool measurePhases)
+{
+	FILETIME timeNow;
+	SecureZeroMemory(&record, sizeof(history_record_t));
+	GetSystemTimeAsFileTime(&timeNow);
+	record.key = hashString(name);
+	record.timestamp = fileTimeToU64(&timeNow);
+	record.clockType = (DWORD)clock_type;
+	record.flags = measurePhases ? HISTORY_FLAG_PHASE_TIMES : 0U;
+	strncpy_s(record.name, sizeof(record.name), toUtf8(name).c_str(), _TRUNCATE);
+	strncpy_s(record.tag, sizeof(record.tag), toUtf8(tag).c_str(), _TRUNCATE);
+}
+
+static bool appendHistory(const tstring &fileName, const history_record_t &record)
+{
+	// Concurrent writers are serialized by the share mode
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	for (int retry = 0; retry < 50; ++retry)
+	{
+		if ((hFile = CreateFile(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)) != INVALID_HANDLE_VALUE)
+		{
+			break;
+		}
+		Sleep(100);
+	}
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	history_header_t header;
+	DWORD bytesTransferred = 0;
+	if (!ReadFile(hFile, &header, sizeof(history_header_t), &bytesTransferred, NULL))
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+	if (bytesTransferred == 0)
+	{
+		SecureZeroMemory(&header, sizeof(history_header_t));
+		memcpy(header.magic, HISTORY_MAGIC, sizeof(header.magic));
+		header.version = HISTORY_VERSION;
+		header.recordSize = sizeof(history_record_t);
+	}
+	else if ((bytesTransferred != sizeof(history_header_t)) || (!checkHistoryHeader(header)))
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	// The record is written and flushed to the disk first, and the record count is updated afterwards, so an interrupted write (or a
+	// power loss) leaves the file consistent; without the flush, the header could reach the disk before the record does
+	LARGE_INTEGER offset;
+	offset.QuadPart = sizeof(history_header_t) + (header.recordCount * sizeof(history_record_t));
+	bool success = SetFilePointerEx(hFile, offset, NULL, FILE_BEGIN) && WriteFile(hFile, &record, sizeof(history_record_t), &bytesTransferred, NULL) && (bytesTransferred == sizeof(history_record_t)) && FlushFileBuffers(hFile);
+	if (success)
+	{
+		++header.recordCount;
+		offset.QuadPart = 0LL;
+		success = SetFilePointerEx(hFile, offset, NULL, FILE_BEGIN) && WriteFile(hFile, &header, sizeof(history_header_t), &bytesTransferred, NULL) && (bytesTransferred == sizeof(history_header_t));
+		FlushFileBuffers(hFile);
+	}
+
+	CloseHandle(hFile);
+	return success;
+}
+
+static bool compareHistoryRecords(const history_record_t *const a, const history_record_t *const b)
+{
+	if (a->key != b->key) return (a->key < b->key);
+	if (a->clockType != b->clockType) return (a->clockType < b->clockType);
+	if (a->flags != b->flags) return (a->flags < b->flags);
+	return (a->timestamp < b->timestamp);
+}
+
+static bool compareChangePoints(const change_point_t &a, const change_point_t &b)
+{
+	return (a.shift > b.shift);
+}
+
+static void detectChangePoints(const std::vector<double> &values, const size_t begin, const size_t end, std::vector<size_t> &changes)
+{
+	// Binary segmentation: find the split that maximizes the (CUSUM-like) mean-shift statistic, then recurse into both halves
+	const size_t count = end - begin;
+	if (count < 2U * HISTORY_MIN_SEGMENT)
+	{
+		return;
+	}
+
+	double sum = 0.0, sumSquares = 0.0;
+	for (size_t i = begin; i < end; ++i)
+	{
+		sum += values[i];
+		sumSquares += values[i] * values[i];
+	}
+
+	double bestScore = 0.0, bestShift = 0.0, leftSum = 0.0, leftSquares = 0.0;
+	size_t bestSplit = 0;
+	for (size_t i = begin; i < end - HISTORY_MIN_SEGMENT; ++i)
+	{
+		leftSum += values[i];
+		leftSquares += values[i] * values[i];
+		const size_t leftCount = i - begin + 1U, rightCount = count - leftCount;
+		if (leftCount < HISTORY_MIN_SEGMENT)
+		{
+			continue;
+		}
+		const double leftMean = leftSum / leftCount, rightMean = (sum - leftSum) / rightCount;
+		const double squaredErrors = (leftSquares - (leftSum * leftMean)) + ((sumSquares - leftSquares) - ((sum - leftSum) * rightMean));
+		const double stddev = std::max(sqrt(std::max(squaredErrors, 0.0) / (count - 2U)), 1e-3 * fabs(sum / count));
+		const double score = fabs(rightMean - leftMean) / (stddev * sqrt((1.0 / leftCount) + (1.0 / rightCount)));
+		if (score > bestScore)
+		{
+			bestScore = score;
+			bestShift = (leftMean > 0.0) ? fabs((rightMean / leftMean) - 1.0) : 0.0;
+			bestSplit = i + 1U;
+		}
+	}
+
+	if ((bestScore >= HISTORY_CHANGE_THRESHOLD) && (bestShift >= HISTORY_MIN_SHIFT))
+	{
+		detectChangePoints(values, begin, bestSplit, changes);
+		changes.push_back(bestSplit);
+		detectChangePoints(values, bestSplit, end, changes);
+	}
+}
+
+static std::string formatTimestamp(const ULONGLONG timestamp)
+{
+	ULARGE_INTEGER temp;
+	FILETIME fileTime;
+	SYSTEMTIME systemTime;
+	temp.QuadPart = timestamp;
+	fileTime.dwHighDateTime = temp.HighPart;
+	fileTime.dwLowDateTime = temp.LowPart;
+	char buffer[32] = { '\0' };
+	if (FileTimeToSystemTime(&fileTime, &systemTime))
+	{
+		sprintf_s(buffer, sizeof(buffer), "%04u-%02u-%02u %02u:%02u", systemTime.wYear, systemTime.wMonth, systemTime.wDay, systemTime.wHour, systemTime.wMinute);
+	}
+	return std::string(buffer);
+}
+
+static std::string getRecordString(const char *const field, const size_t size)
+{
+	// The history file is mapped as-is, so a damaged record may not contain a terminating NUL character
+	return std::string(field, strnlen(field, size));
+}
+
+static std::string formatSeries(const history_record_t *const record)
+{
+	// Runs with phase times were measured under a debugger, so they form a separate series
+	return getRecordString(record->name, sizeof(record->name)) + " [" + printClockType((clock_type_t)record->clockType) + (((record->flags & HISTORY_FLAG_PHASE_TIMES) != 0U) ? ", PHASE_TIMES]" : "]");
+}
+
+static void printChangePoint(const change_point_t &change, const bool printName)
+{
+	if (printName)
+	{
+		std::cerr << formatSeries(change.after) << ": ";
+	}
+	std::cerr << ((change.meanAfter > change.meanBefore) ? '+' : '-') << std::setprecision(1) << (100.0 * change.shift) << "% (" << std::setprecision(3) << change.meanBefore << " -> " << change.meanAfter << " seconds)" << std::endl;
+	std::cerr << "    since " << (change.after->tag[0] ? getRecordString(change.after->tag, sizeof(change.after->tag)) : "<untagged>") << " (" << formatTimestamp(change.after->timestamp) << "), previously " << (change.before->tag[0] ? getRecordString(change.before->tag, sizeof(change.before->tag)) : "<untagged>") << " (" << formatTimestamp(change.before->timestamp) << ')' << std::endl;
+}
+
+static int queryHistory(const tstring &fileName)
+{
+	const LONGLONG timeStart = getPerfCounter();
+	const HANDLE hFile = CreateFile(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		_ftprintf(stderr, _T("Failed to open the specified history file for reading:\n%s\n\n"), fileName.c_str());
+		return EXIT_FAILURE;
+	}
+
+	LARGE_INTEGER fileSize;
+	const HANDLE hMapping = (GetFileSizeEx(hFile, &fileSize) && (fileSize.QuadPart >= (LONGLONG)sizeof(history_header_t))) ? CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	const BYTE *const view = hMapping ? (const BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if ((!view) || (!checkHistoryHeader(*((const history_header_t*)view))))
+	{
+		_ftprintf(stderr, _T("The specified history file is empty or invalid:\n%s\n\n"), fileName.c_str());
+		if (view) UnmapViewOfFile(view);
+		if (hMapping) CloseHandle(hMapping);
+		CloseHandle(hFile);
+		return EXIT_FAILURE;
+	}
+
+	// Build an index of all records, ordered by benchmark, clock type, flags and time
+	const history_record_t *const records = (const history_record_t*)(view + sizeof(history_header_t));
+	const size_t recordCount = (size_t)std::min(((const history_header_t*)view)->recordCount, (ULONGLONG)((fileSize.QuadPart - sizeof(history_header_t)) / sizeof(history_record_t)));
+	std::vector<const history_record_t*> index(recordCount);
+	for (size_t i = 0; i < recordCount; ++i)
+	{
+		index[i] = &records[i];
+	}
+	std::stable_sort(index.begin(), index.end(), compareHistoryRecords);
+
+	// Detect the change points in the series of median execution times of each benchmark
+	std::vector<change_point_t> regressions;
+	std::vector<double> values;
+	std::vector<size_t> changes;
+	size_t benchmarkCount = 0;
+	std::cerr << std::setprecision(3) << std::fixed;
+	std::cerr << "===============================================================================" << std::endl;
+	std::cerr << "CHANGE POINTS" << std::endl;
+	std::cerr << "-------------------------------------------------------------------------------" << std::endl;
+	for (size_t first = 0, last = 0; first < recordCount; first = last)
+	{
+		values.clear();
+		changes.clear();
+		for (last = first; (last < recordCount) && (index[last]->key == index[first]->key) && (index[last]->clockType == index[first]->clockType) && (index[last]->flags == index[first]->flags); ++last)
+		{
+			values.push_back(index[last]->median);
+		}
+		++benchmarkCount;
+		detectChangePoints(values, 0U, values.size(), changes);
+		if (!changes.empty())
+		{
+			std::cerr << formatSeries(index[first]) << ", " << values.size() << " runs:" << std::endl;
+		}
+		for (size_t i = 0; i < changes.size(); ++i)
+		{
+			const size_t segmentBegin = (i > 0U) ? changes[i - 1U] : 0U, segmentEnd = ((i + 1U) < changes.size()) ? changes[i + 1U] : values.size();
+			double sumBefore = 0.0, sumAfter = 0.0;
+			for (size_t j = segmentBegin; j < changes[i]; ++j) sumBefore += values[j];
+			for (size_t j = changes[i]; j < segmentEnd; ++j) sumAfter += values[j];
+			change_point_t change = { index[first + changes[i] - 1U], index[first + changes[i]], sumBefore / (changes[i] - segmentBegin), sumAfter / (segmentEnd - changes[i]), 0.0 };
+			change.shift = (change.meanBefore > 0.0) ? fabs((change.meanAfter / change.meanBefore) - 1.0) : 0.0;
+			std::cerr << "  ";
+			printChangePoint(change, false);
+			if (change.meanAfter > change.meanBefore)
+			{
+				regressions.push_back(change);
+			}
+		}
+	}
+
+	std::sort(regressions.begin(), regressions.end(), compareChangePoints);
+	std::cerr << "-------------------------------------------------------------------------------" << std::endl;
+	std::cerr << "TOP REGRESSIONS" << std::endl;
+	std::cerr << "-------------------------------------------------------------------------------" << std::endl;
+	if (regressions.empty())
+	{
+		std::cerr << "No regressions have been detected." << std::endl;
+	}
+	for (size_t i = 0; (i < regressions.size()) && (i < HISTORY_TOP_REGRESSIONS); ++i)
+	{
+		std::cerr << std::setw(2) << (i + 1U) << ". ";
+		printChangePoint(regressions[i], true);
+	}
+	std::cerr << "-------------------------------------------------------------------------------" << std::endl;
+	std::cerr << "Analyzed " << recordCount << " runs of " << benchmarkCount << " benchmarks in " << getPerfCounterElapsed(timeStart, getPerfCounter()) << " seconds." << std::endl;
+	std::cerr << "===============================================================================\n" << std::endl;
+
+	UnmapViewOfFile(view);
+	CloseHandle(hMapping);
+	CloseHandle(hFile);
+	return EXIT_SUCCESS;
+}
+
+// =============================================================================================================
+// DAEMON AND CLIENT MODE
+// =============================================================================================================
+
+static CRITICAL_SECTION g_queueLock;
+static std::deque<daemon_job_t*> g_jobQueue;
+static daemon_job_t *g_runningJob = NULL;
+static unsigned int g_nextJobId = 1U;
+static HANDLE g_hQueueSemaphore = NULL;
+static std::vector<BYTE> g_daemonUser;
+
+static bool waitForPipe(const HANDLE hPipe, OVERLAPPED &overlapped, const BOOL started, DWORD &bytesTransferred, const DWORD timeout)
+{
+	// Returns the result of the overlapped operation; a pending operation is cancelled, if it does not complete in time
+	if ((!started) && (GetLastError() == ERROR_IO_PENDING))
+	{
+		if (WaitForSingleObject(overlapped.hEvent, timeout) != WAIT_OBJECT_0)
+		{
+			CancelIo(hPipe);
+			GetOverlappedResult(hPipe, &overlapped, &bytesTransferred, TRUE);
+			SetLastError(ERROR_TIMEOUT);
+			return false;
+		}
+	}
+	else if ((!started) && (GetLastError() != ERROR_MORE_DATA))
+	{
+		return false;
+	}
+	return GetOverlappedResult(hPipe, &overlapped, &bytesTransferred, FALSE) ? true : false;
+}
+
+static bool readMessage(const HANDLE hPipe, std::vector<char> &message, const DWORD timeout)
+{
+	char buffer[PIPE_BUFFER_SIZE];
+	OVERLAPPED overlapped;
+	SecureZeroMemory(&overlapped, sizeof(OVERLAPPED));
+	if (!(overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+	{
+		return false;
+	}
+	message.clear();
+	for (;;)
+	{
+		DWORD bytesRead = 0;
+		ResetEvent(overlapped.hEvent);
+		const bool success = waitForPipe(hPipe, overlapped, ReadFile(hPipe, buffer, sizeof(buffer), &bytesRead, &overlapped), bytesRead, timeout);
+		if ((!success) && (GetLastError() != ERROR_MORE_DATA))
+		{
+			CloseHandle(overlapped.hEvent);
+			return false;
+		}
+		message.insert(message.end(), buffer, buffer + bytesRead);
+		if (success)
+		{
+			CloseHandle(overlapped.hEvent);
+			return (!message.empty());
+		}
+	}
+}
+
+static bool writeMessage(const HANDLE hPipe, const char type, const char *const data, const size_t length)
+{
+	std::vector<char> message(1U, type);
+	message.insert(message.end(), data, data + length);
+	OVERLAPPED overlapped;
+	SecureZeroMemory(&overlapped, sizeof(OVERLAPPED));
+	if (!(overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+	{
+		return false;
+	}
+	DWORD bytesWritten = 0;
+	const bool success = waitForPipe(hPipe, overlapped, WriteFile(hPipe, message.data(), (DWORD)message.size(), &bytesWritten, &overlapped), bytesWritten, PIPE_WRITE_TIMEOUT);
+	CloseHandle(overlapped.hEvent);
+	return success && (bytesWritten == message.size());
+}
+
+static bool writeMessage(const HANDLE hPipe, const char type, const std::string &text)
+{
+	return writeMessage(hPipe, type, text.c_str(), text.size());
+}
+
+static bool isClientConnected(const HANDLE hPipe)
+{
+	// Peeking fails with ERROR_BROKEN_PIPE, as soon as the client has closed its end of the pipe
+	DWORD bytesAvailable;
+	return PeekNamedPipe(hPipe, NULL, 0U, NULL, &bytesAvailable, NULL) ? true : false;
+}
+
+static void closeClientPipe(const HANDLE hPipe)
+{
+	// Not calling DisconnectNamedPipe() here, because that would discard the data that the client has not read yet
+	CloseHandle(hPipe);
+}
+
+static std::string getQueueStatus(void)
+{
+	std::ostringstream status;
+	EnterCriticalSection(&g_queueLock);
+	if (g_runningJob)
+	{
+		status << "Running job #" << g_runningJob->id << ":\n  " << toUtf8(g_runningJob->commandLine) << "\n\n";
+	}
+	else
+	{
+		status << "No job is running.\n\n";
+	}
+	status << "Queued jobs: " << g_jobQueue.size() << '\n';
+	for (size_t i = 0; i < g_jobQueue.size(); ++i)
+	{
+		status << "  [" << (i + 1U) << "] Job #" << g_jobQueue[i]->id << ": " << toUtf8(g_jobQueue[i]->commandLine) << '\n';
+	}
+	LeaveCriticalSection(&g_queueLock);
+	status << '\n';
+	return status.str();
+}
+
+static bool parseJobRequest(const std::vector<char> &message, daemon_job_t &job)
+{
+	// Request layout: 'J' <directory> NUL <command-line> NUL <environment variable> NUL ... NUL
+	std::vector<std::string> fields;
+	std::vector<char>::const_iterator start = message.cbegin() + 1;
+	for (std::vector<char>::const_iterator iter = start; iter != message.cend(); ++iter)
+	{
+		if (!(*iter))
+		{
+			fields.push_back(std::string(start, iter));
+			start = iter + 1;
+		}
+	}
+	if ((fields.size() < 2U) || fields[0].empty() || fields[1].empty())
+	{
+		return false;
+	}
+
+	job.directory = fromUtf8(fields[0]);
+	job.commandLine = fromUtf8(fields[1]);
+	job.environment.clear();
+	for (size_t i = 2; i < fields.size(); ++i)
+	{
+		if (!fields[i].empty())
+		{
+			// The client filters these variables too, but a job must never be able to re-submit itself to the daemon (which would deadlock the worker)
+			const tstring variable = fromUtf8(fields[i]);
+			if ((!_wcsnicmp(variable.c_str(), L"TIMED_EXEC_CLIENT=", 18)) || (!_wcsnicmp(variable.c_str(), L"TIMED_EXEC_DAEMON=", 18)))
+			{
+				continue;
+			}
+			job.environment.insert(job.environment.end(), variable.begin(), variable.end());
+			job.environment.push_back(L'\0');
+		}
+	}
+	job.environment.push_back(L'\0');
+	if (job.environment.size() < 2U) job.environment.push_back(L'\0');
+	return true;
+}
+
+static bool getTokenUser(const HANDLE hToken, std::vector<BYTE> &tokenUser)
+{
+	DWORD size = 0;
+	GetTokenInformation(hToken, TokenUser, NULL, 0, &size);
+	if (size < sizeof(TOKEN_USER))
+	{
+		return false;
+	}
+	tokenUser.resize(size);
+	return GetTokenInformation(hToken, TokenUser, tokenUser.data(), size, &size) ? true : false;
+}
+
+static bool getTokenElevation(const HANDLE hToken, DWORD &integrityLevel, DWORD &elevated)
+{
+	TOKEN_ELEVATION elevation;
+	DWORD size = 0;
+	if (!GetTokenInformation(hToken, TokenElevation, &elevation, sizeof(TOKEN_ELEVATION), &size))
+	{
+		return false; /*not supported before Windows Vista*/
+	}
+	elevated = elevation.TokenIsElevated;
+	GetTokenInformation(hToken, TokenIntegrityLevel, NULL, 0, &size);
+	if (size < sizeof(TOKEN_MANDATORY_LABEL))
+	{
+		return false;
+	}
+	std::vector<BYTE> label(size);
+	if (!GetTokenInformation(hToken, TokenIntegrityLevel, label.data(), size, &size))
+	{
+		return false;
+	}
+	const PSID sid = ((const TOKEN_MANDATORY_LABEL*)label.data())->Label.Sid;
+	integrityLevel = *GetSidSubAuthority(sid, (DWORD)(*GetSidSubAuthorityCount(sid) - 1U));
+	return true;
+}
+
+static bool isSameSecurityContext(const HANDLE hClientToken)
+{
+	// The same user is not enough, because an elevated daemon must never run the jobs of an unelevated client with its own token
+	HANDLE hProcessToken = NULL;
+	std::vector<BYTE> clientUser;
+	DWORD clientLevel = 0, clientElevated = 0, daemonLevel = 0, daemonElevated = 0;
+	bool sameContext = false;
+	if (getTokenUser(hClientToken, clientUser) && EqualSid(((const TOKEN_USER*)clientUser.data())->User.Sid, ((const TOKEN_USER*)g_daemonUser.data())->User.Sid)
+		&& OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &hProcessToken))
+	{
+		const bool clientUac = getTokenElevation(hClientToken, clientLevel, clientElevated);
+		const bool daemonUac = getTokenElevation(hProcessToken, daemonLevel, daemonElevated);
+		sameContext = (clientUac == daemonUac) && ((!clientUac) || ((clientLevel == daemonLevel) && (clientElevated == daemonElevated)));
+		CloseHandle(hProcessToken);
+	}
+	return sameContext;
+}
+
+static bool getClientToken(const HANDLE hPipe, HANDLE &hToken, bool &sameContext)
+{
+	// Jobs are always run with (a primary copy of) the client's token
+	HANDLE hThreadToken = NULL;
+	bool success = false;
+	hToken = NULL;
+	sameContext = false;
+	if (!ImpersonateNamedPipeClient(hPipe))
+	{
+		return false;
+	}
+	const BOOL opened = OpenThreadToken(GetCurrentThread(), TOKEN_QUERY | TOKEN_DUPLICATE | TOKEN_ASSIGN_PRIMARY, TRUE, &hThreadToken);
+	if (!RevertToSelf())
+	{
+		_exit(-1); /*must never continue in the security context of the client*/
+	}
+	if (opened)
+	{
+		if ((success = DuplicateTokenEx(hThreadToken, TOKEN_QUERY | TOKEN_DUPLICATE | TOKEN_ASSIGN_PRIMARY | TOKEN_ADJUST_DEFAULT | TOKEN_ADJUST_SESSIONID, NULL, SecurityImpersonation, TokenPrimary, &hToken) ? true : false))
+		{
+			sameContext = isSameSecurityContext(hThreadToken);
+		}
+		CloseHandle(hThreadToken);
+	}
+	return success;
+}
+
+static bool createProcessWithToken(const HANDLE hToken, const tstring &commandLine, const DWORD creationFlags, const daemon_job_t *const job, const STARTUPINFO &startInfo, PROCESS_INFORMATION &processInfo)
+{
+	// CreateProcessWithTokenW() requires the "impersonate" privilege instead of the "assign primary token" privilege, but it is available since Windows Vista only
+	typedef BOOL (WINAPI *CreateProcessWithTokenFn)(HANDLE, DWORD, LPCWSTR, LPWSTR, DWORD, LPVOID, LPCWSTR, LPSTARTUPINFOW, LPPROCESS_INFORMATION);
+	const CreateProcessWithTokenFn createProcessWithTokenW = (CreateProcessWithTokenFn)GetProcAddress(GetModuleHandle(_T("advapi32.dll")), "CreateProcessWithTokenW");
+	if (!createProcessWithTokenW)
+	{
+		SetLastError(ERROR_PRIVILEGE_NOT_HELD);
+		return false;
+	}
+	// The process is created by the secondary logon service, which does not support CREATE_NO_WINDOW, so its console is hidden instead
+	STARTUPINFO hiddenStartInfo = startInfo;
+	hiddenStartInfo.dwFlags |= STARTF_USESHOWWINDOW;
+	hiddenStartInfo.wShowWindow = SW_HIDE;
+	return createProcessWithTokenW(hToken, 0U, NULL, (LPWSTR)commandLine.c_str(), creationFlags & (~DWORD(CREATE_NO_WINDOW)), (LPVOID)job->environment.data(), job->directory.c_str(), &hiddenStartInfo, &processInfo) ? true : false;
+}
+
+static bool createPipeSecurity(SECURITY_ATTRIBUTES &secAttr)
+{
+	// Authenticated local users may submit jobs, but only the daemon's own user, administrators and SYSTEM may create pipe instances; network logons are denied
+	LPTSTR daemonSid = NULL;
+	if (!ConvertSidToStringSid(((const TOKEN_USER*)g_daemonUser.data())->User.Sid, &daemonSid))
+	{
+		return false;
+	}
+	const tstring sddl = tstring(_T("D:P(D;;GA;;;NU)(A;;GA;;;SY)(A;;GA;;;BA)(A;;GA;;;")) + daemonSid + _T(")(A;;0x12018b;;;AU)");
+	LocalFree(daemonSid);
+	SecureZeroMemory(&secAttr, sizeof(SECURITY_ATTRIBUTES));
+	secAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
+	secAttr.bInheritHandle = FALSE;
+	return ConvertStringSecurityDescriptorToSecurityDescriptor(sddl.c_str(), SDDL_REVISION_1, &secAttr.lpSecurityDescriptor, NULL) ? true : false;
+}
+
+static int runDaemonJob(const tstring &programFile, daemon_job_t *const job)
+{
+	SECURITY_ATTRIBUTES secAttr = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+	HANDLE hReadPipe = NULL, hWritePipe = NULL;
+	if (!CreatePipe(&hReadPipe, &hWritePipe, &secAttr, 0))
+	{
+		return -1;
+	}
+	SetHandleInformation(hReadPipe, HANDLE_FLAG_INHERIT, 0);
+
+	// All processes of the job get killed, if the client disconnects or the daemon exits
+	HANDLE hJob = CreateJobObject(NULL, NULL);
+	JOBOBJECT_EXTENDED_LIMIT_INFORMATION jobInfo;
+	SecureZeroMemory(&jobInfo, sizeof(JOBOBJECT_EXTENDED_LIMIT_INFORMATION));
+	jobInfo.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+	if (hJob) SetInformationJobObject(hJob, JobObjectExtendedLimitInformation, &jobInfo, sizeof(JOBOBJECT_EXTENDED_LIMIT_INFORMATION));
+
+	STARTUPINFO startInfo;
+	SecureZeroMemory(&startInfo, sizeof(STARTUPINFO));
+	startInfo.cb = sizeof(STARTUPINFO);
+	startInfo.dwFlags = STARTF_USESTDHANDLES;
+	startInfo.hStdInput = NULL;
+	startInfo.hStdOutput = startInfo.hStdError = hWritePipe;
+	PROCESS_INFORMATION processInfo;
+	SecureZeroMemory(&processInfo, sizeof(PROCESS_INFORMATION));
+
+	tstring commandLine(_T("\""));
+	commandLine += programFile + _T("\" ") + job->commandLine;
+
+	// The job is always run with the client's token; only if neither function can use that token, a job of the *same* security context may run with the daemon's token
+	const DWORD creationFlags = CREATE_SUSPENDED | CREATE_NO_WINDOW | CREATE_UNICODE_ENVIRONMENT;
+	bool created = CreateProcessAsUser(job->hToken, NULL, (LPTSTR)commandLine.c_str(), NULL, NULL, TRUE, creationFlags, job->environment.data(), job->directory.c_str(), &startInfo, &processInfo) ? true : false;
+	DWORD error = GetLastError();
+	if ((!created) && (error == ERROR_PRIVILEGE_NOT_HELD))
+	{
+		created = createProcessWithToken(job->hToken, commandLine, creationFlags, job, startInfo, processInfo);
+		error = GetLastError();
+	}
+	if ((!created) && (error == ERROR_PRIVILEGE_NOT_HELD) && job->sameContext)
+	{
+		created = CreateProcess(NULL, (LPTSTR)commandLine.c_str(), NULL, NULL, TRUE, creationFlags, job->environment.data(), job->directory.c_str(), &startInfo, &processInfo) ? true : false;
+		error = GetLastError();
+	}
+	CloseHandle(hWritePipe);
+	if (!created)
+	{
+		std::ostringstream message;
+		message << "Failed to create the job process! (Error: " << error << ")\n";
+		if ((error == ERROR_PRIVILEGE_NOT_HELD) && (!job->sameContext)) message << "Running jobs of other users (or with a different elevation) requires the daemon to run as LocalSystem.\n";
+		writeMessage(job->hPipe, 'O', message.str() + '\n');
+		CloseHandle(hReadPipe);
+		if (hJob) CloseHandle(hJob);
+		return -1;
+	}
+
+	if (hJob) AssignProcessToJobObject(hJob, processInfo.hProcess);
+	ResumeThread(processInfo.hThread);
+
+	// Forward the output of the job to the client, until the job terminates; the client is polled, so that the job can be killed as soon as the client disconnects
+	char buffer[PIPE_BUFFER_SIZE];
+	bool clientConnected = true;
+	for (;;)
+	{
+		DWORD bytesAvailable = 0, bytesRead = 0;
+		if (!PeekNamedPipe(hReadPipe, NULL, 0U, NULL, &bytesAvailable, NULL))
+		{
+			break; /*all processes of the job have closed their output*/
+		}
+		if (bytesAvailable > 0U)
+		{
+			if (!(ReadFile(hReadPipe, buffer, std::min<DWORD>(bytesAvailable, sizeof(buffer)), &bytesRead, NULL) && (bytesRead > 0U)))
+			{
+				break;
+			}
+			if (!writeMessage(job->hPipe, 'O', buffer, bytesRead))
+			{
+				clientConnected = false;
+				break;
+			}
+		}
+		else if (!isClientConnected(job->hPipe))
+		{
+			clientConnected = false;
+			break;
+		}
+		else
+		{
+			Sleep(PIPE_POLL_INTERVAL);
+		}
+	}
+
+	if (!clientConnected)
+	{
+		if (hJob)
+		{
+			CloseHandle(hJob);
+			hJob = NULL;
+		}
+		TerminateProcess(processInfo.hProcess, UINT(-1));
+	}
+
+	WaitForSingleObject(processInfo.hProcess, INFINITE);
+	const int exitCode = clientConnected ? getProcessExitCode(processInfo.hProcess) : -1;
+
+	CloseHandle(processInfo.hThread);
+	CloseHandle(processInfo.hProcess);
+	CloseHandle(hReadPipe);
+	if (hJob) CloseHandle(hJob);
+	return exitCode;
+}
+
+static DWORD WINAPI daemonWorkerThread(LPVOID lpParameter)
+{
+	const tstring &programFile = *reinterpret_cast<const tstring*>(lpParameter);
+	for (;;)
+	{
+		if (WaitForSingleObject(g_hQueueSemaphore, INFINITE) != WAIT_OBJECT_0)
+		{
+			return 1;
+		}
+
+		EnterCriticalSection(&g_queueLock);
+		daemon_job_t *const job = g_jobQueue.empty() ? NULL : g_jobQueue.front();
+		if (job) g_jobQueue.pop_front();
+		g_runningJob = job;
+		LeaveCriticalSection(&g_queueLock);
+
+		if (job)
+		{
+			if (isClientConnected(job->hPipe))
+			{
+				_ftprintf(stderr, _T("Job #%u started:\n%s\n\n"), job->id, job->commandLine.c_str());
+				const int exitCode = runDaemonJob(programFile, job);
+				char exitCodeStr[16];
+				sprintf_s(exitCodeStr, sizeof(exitCodeStr), "%d", exitCode);
+				writeMessage(job->hPipe, 'X', exitCodeStr);
+				_ftprintf(stderr, _T("Job #%u completed. (Exit Code: %d)\n\n"), job->id, exitCode);
+			}
+			else
+			{
+				_ftprintf(stderr, _T("Job #%u dropped, because the client has disconnected.\n\n"), job->id);
+			}
+			closeClientPipe(job->hPipe);
+			if (job->hToken) CloseHandle(job->hToken);
+
+			EnterCriticalSection(&g_queueLock);
+			g_runningJob = NULL;
+			LeaveCriticalSection(&g_queueLock);
+			delete job;
+		}
+	}
+}
+
+static DWORD WINAPI daemonConnectionThread(LPVOID lpParameter)
+{
+	const HANDLE hPipe = reinterpret_cast<HANDLE>(lpParameter);
+
+	// A client that does not send its request in time must not keep the connection open forever
+	std::vector<char> request;
+	if (!readMessage(hPipe, request, PIPE_REQUEST_TIMEOUT))
+	{
+		closeClientPipe(hPipe);
+		return 1;
+	}
+
+	if (request[0] == 'J')
+	{
+		daemon_job_t *const job = new daemon_job_t;
+		job->hPipe = hPipe;
+		job->hToken = NULL;
+		job->sameContext = false;
+		if (!parseJobRequest(request, *job))
+		{
+			writeMessage(hPipe, 'O', "Invalid request!\n\n");
+			writeMessage(hPipe, 'X', "-1");
+		}
+		else if (!getClientToken(hPipe, job->hToken, job->sameContext))
+		{
+			writeMessage(hPipe, 'O', "Failed to determine the security context of the client!\n\n");
+			writeMessage(hPipe, 'X', "-1");
+		}
+		else
+		{
+			EnterCriticalSection(&g_queueLock);
+			job->id = g_nextJobId++;
+			const size_t position = g_jobQueue.size() + (g_runningJob ? 2U : 1U);
+			LeaveCriticalSection(&g_queueLock);
+			std::ostringstream message;
+			message << "Job #" << job->id << " has been queued (position " << position << ").\n\n";
+			writeMessage(hPipe, 'O', message.str());
+			EnterCriticalSection(&g_queueLock);
+			g_jobQueue.push_back(job);
+			LeaveCriticalSection(&g_queueLock);
+			ReleaseSemaphore(g_hQueueSemaphore, 1, NULL);
+			return 0;
+		}
+		delete job;
+	}
+	else if (request[0] == 'S')
+	{
+		writeMessage(hPipe, 'O', getQueueStatus());
+		writeMessage(hPipe, 'X', "0");
+	}
+	else
+	{
+		writeMessage(hPipe, 'O', "Invalid request!\n\n");
+		writeMessage(hPipe, 'X', "-1");
+	}
+
+	closeClientPipe(hPipe);
+	return 0;
+}
+
+static DWORD WINAPI daemonListenerThread(LPVOID lpParameter)
+{
+	const tstring &pipeName = *reinterpret_cast<const tstring*>(lpParameter);
+	SECURITY_ATTRIBUTES secAttr;
+	OVERLAPPED overlapped;
+	SecureZeroMemory(&overlapped, sizeof(OVERLAPPED));
+	if ((!createPipeSecurity(secAttr)) || (!(overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL))))
+	{
+		std::cerr << "\nSYSTEM ERROR: Failed to initialize the named pipe!\n" << std::endl;
+		SetEvent(g_hAbortEvent);
+		return 1;
+	}
+
+	for (DWORD firstInstance = FILE_FLAG_FIRST_PIPE_INSTANCE;; firstInstance = 0U)
+	{
+		HANDLE hPipe = CreateNamedPipe(pipeName.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | firstInstance, PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES, PIPE_BUFFER_SIZE, PIPE_BUFFER_SIZE, 0, &secAttr);
+		if (hPipe == INVALID_HANDLE_VALUE)
+		{
+			// PIPE_REJECT_REMOTE_CLIENTS is not supported prior to Windows Vista
+			hPipe = CreateNamedPipe(pipeName.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | firstInstance, PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT, PIPE_UNLIMITED_INSTANCES, PIPE_BUFFER_SIZE, PIPE_BUFFER_SIZE, 0, &secAttr);
+		}
+		if (hPipe == INVALID_HANDLE_VALUE)
+		{
+			if (firstInstance && (GetLastError() == ERROR_ACCESS_DENIED))
+			{
+				std::cerr << "\nSYSTEM ERROR: The named pipe is already in use by another process!\n" << std::endl;
+			}
+			else
+			{
+				std::cerr << "\nSYSTEM ERROR: Failed to create the named pipe!\n" << std::endl;
+			}
+			SetEvent(g_hAbortEvent);
+			return 1;
+		}
+
+		// Each connection is handled by its own thread, so that a slow client does not block the other clients
+		DWORD bytesTransferred;
+		ResetEvent(overlapped.hEvent);
+		const bool connected = ConnectNamedPipe(hPipe, &overlapped) || (GetLastError() == ERROR_PIPE_CONNECTED)
+			|| ((GetLastError() == ERROR_IO_PENDING) && GetOverlappedResult(hPipe, &overlapped, &bytesTransferred, TRUE));
+		const HANDLE hThread = connected ? CreateThread(NULL, 0, daemonConnectionThread, hPipe, 0, NULL) : NULL;
+		if (hThread)
+		{
+			CloseHandle(hThread);
+		}
+		else
+		{
+			CloseHandle(hPipe);
+		}
+	}
+}
+
+static int daemonMain(const tstring &pipeName)
+{
+	std::vector<TCHAR> buffer(MAX_PATH);
+	const DWORD length = GetModuleFileName(NULL, buffer.data(), (DWORD)buffer.size());
+	if ((length == 0) || (length >= buffer.size()))
+	{
+		std::cerr << "SYSTEM ERROR: Failed to determine the path of the executable file!\n" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	HANDLE hProcessToken = NULL;
+	const bool haveUser = OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &hProcessToken) && getTokenUser(hProcessToken, g_daemonUser);
+	if (hProcessToken) CloseHandle(hProcessToken);
+	if (!haveUser)
+	{
+		std::cerr << "SYSTEM ERROR: Failed to determine the user of the daemon!\n" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const tstring programFile(buffer.data(), length);
+	InitializeCriticalSection(&g_queueLock);
+	if (!(g_hQueueSemaphore = CreateSemaphore(NULL, 0, LONG_MAX, NULL)))
+	{
+		std::cerr << "SYSTEM ERROR: Semaphore object could not be created!\n" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	_ftprintf(stderr, _T("Daemon is listening on pipe:\n%s\n\n"), pipeName.c_str());
+
+	HANDLE hThreads[2];
+	hThreads[0] = CreateThread(NULL, 0, daemonWorkerThread, (LPVOID)&programFile, 0, NULL);
+	hThreads[1] = hThreads[0] ? CreateThread(NULL, 0, daemonListenerThread, (LPVOID)&pipeName, 0, NULL) : NULL;
+	if (!hThreads[1])
+	{
+		std::cerr << "SYSTEM ERROR: Failed to create the daemon threads!\n" << std::endl;
+		ExitProcess(EXIT_FAILURE);
+	}
+
+	// Run until the daemon gets stopped by the user; the process is terminated right away, because the daemon threads are still using the job queue
+	// and the local variables of this function. The running job is killed on exit, because of the job object
+	WaitForSingleObject(g_hAbortEvent, INFINITE);
+	std::cerr << "Daemon has been stopped.\n" << std::endl;
+	ExitProcess(g_aborted ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static int clientMain(const tstring &pipeName, const tstring &commandLine)
+{
+	HANDLE hPipe = INVALID_HANDLE_VALUE;
+	DWORD error = ERROR_SUCCESS;
+	for (int retry = 0; retry < 3; ++retry)
+	{
+		// Not requesting GENERIC_WRITE, because that includes the right to create new pipe instances, which is granted to the daemon's user only
+		if ((hPipe = CreateFile(pipeName.c_str(), GENERIC_READ | FILE_WRITE_DATA | FILE_WRITE_ATTRIBUTES, 0, NULL, OPEN_EXISTING, 0, NULL)) != INVALID_HANDLE_VALUE)
+		{
+			break;
+		}
+		if (((error = GetLastError()) != ERROR_PIPE_BUSY) || (!WaitNamedPipe(pipeName.c_str(), 10000)))
+		{
+			break;
+		}
+	}
+	if (hPipe == INVALID_HANDLE_VALUE)
+	{
+		switch (error)
+		{
+		case ERROR_FILE_NOT_FOUND:
+			_ftprintf(stderr, _T("Failed to connect to the daemon. Is the daemon running?\n%s\n\n"), pipeName.c_str());
+			break;
+		case ERROR_ACCESS_DENIED:
+			_ftprintf(stderr, _T("Failed to connect to the daemon. Access denied!\n%s\n\n"), pipeName.c_str());
+			break;
+		case ERROR_PIPE_BUSY:
+			_ftprintf(stderr, _T("Failed to connect to the daemon. The pipe is busy, please try again!\n%s\n\n"), pipeName.c_str());
+			break;
+		default:
+			_ftprintf(stderr, _T("Failed to connect to the daemon. (Error: %u)\n%s\n\n"), error, pipeName.c_str());
+		}
+		return EXIT_FAILURE;
+	}
+
+	DWORD pipeMode = PIPE_READMODE_MESSAGE;
+	SetNamedPipeHandleState(hPipe, &pipeMode, NULL, NULL);
+
+	// Send the request; the job is run with the working directory and the environment of the client
+	std::string request;
+	if (!commandLine.empty())
+	{
+		std::vector<TCHAR> directory(MAX_PATH);
+		const DWORD length = GetCurrentDirectory((DWORD)directory.size(), directory.data());
+		request += toUtf8(tstring(directory.data(), (length < directory.size()) ? length : 0U)) + '\0';
+		request += toUtf8(commandLine) + '\0';
+		WCHAR *const environment = GetEnvironmentStringsW();
+		for (const WCHAR *variable = environment; variable && (*variable); variable += wcslen(variable) + 1U)
+		{
+			if (_wcsnicmp(variable, L"TIMED_EXEC_CLIENT=", 18) && _wcsnicmp(variable, L"TIMED_EXEC_DAEMON=", 18))
+			{
+				request += toUtf8(tstring(variable)) + '\0';
+			}
+		}
+		if (environment) FreeEnvironmentStringsW(environment);
+	}
+
+	int exitCode = EXIT_FAILURE;
+	std::vector<char> message;
+	if (writeMessage(hPipe, commandLine.empty() ? 'S' : 'J', request))
+	{
+		const HANDLE hStdErr = GetStdHandle(STD_ERROR_HANDLE);
+		while (readMessage(hPipe, message, INFINITE))
+		{
+			if (message[0] == 'O')
+			{
+				DWORD bytesWritten;
+				WriteFile(hStdErr, message.data() + 1, (DWORD)(message.size() - 1U), &bytesWritten, NULL);
+			}
+			else if (message[0] == 'X')
+			{
+				exitCode = atoi(std::string(message.begin() + 1, message.end()).c_str());
+				break;
+			}
+		}
+	}
+
+	if (message.empty() || (message[0] != 'X'))
+	{
+		std::cerr << "\n\nSYSTEM ERROR: The connection to the daemon has been lost!\n" << std::endl;
+	}
+
+	CloseHandle(hPipe);
+	return exitCode;
+}
+
 // =============================================================================================================
 // MAIN FUNCTION
 // =============================================================================================================
@@ -426,6 +2325,42 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 	std::ios initFmt(NULL);
 	initFmt.copyfmt(std::cerr);
 
+	/* ---------------------------------------------------------- */
+	/* Daemon and Client Mode                                     */
+	/* ---------------------------------------------------------- */
+
+	tstring pipeName(_T(DEFAULT_PIPE_NAME)), historyFile;
+	bool daemonMode = false, queryMode = false;
+
+	if (ENABLE_ENV_VARS)
+	{
+		tstring temp;
+		if (getEnvVariable(_T("TIMED_EXEC_PIPE_NAME"), temp) && (!temp.empty()))
+		{
+			pipeName = (temp.compare(0, 2, _T("\\\\")) != 0) ? (tstring(_T("\\\\.\\pipe\\")) + temp) : temp;
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_DAEMON"), temp))
+		{
+			daemonMode = parseFlag(temp);
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_HISTORY"), temp) && (!temp.empty()))
+		{
+			historyFile = getFullPath(temp.c_str());
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_QUERY"), temp))
+		{
+			queryMode = parseFlag(temp);
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_CLIENT"), temp) && parseFlag(temp) && (!daemonMode))
+		{
+			// The client just forwards the output of the daemon; a Ctrl+C terminates the client, which cancels the job
+			tstring commandLine, programFile;
+			initializeCommandLine(commandLine, programFile);
+			SetConsoleCtrlHandler(ctrlHandlerRoutine, FALSE);
+			return clientMain(pipeName, commandLine);
+		}
+	}
+
 	std::cerr << "\n===============================================================================" << std::endl;
 	std::cerr << "Timed Exec - Benchmarking Utility, Version " << VERSION_MAJOR << '.' << std::setfill('0') << std::setw(2) << (10 * VERSION_MINOR_HI) + VERSION_MINOR_LO << " [" __DATE__ "]" << std::endl;
 	std::cerr << "Copyright (c) 2023 LoRd_MuldeR <mulder2@gmx.de>. Some rights reserved.\n" << std::endl;
@@ -436,6 +2371,31 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 
 	std::cerr.copyfmt(initFmt);
 
+	if (daemonMode)
+	{
+		tstring temp;
+		if (getEnvVariable(_T("TIMED_EXEC_AFFINITY"), temp) && (!temp.empty()))
+		{
+			// The affinity mask is inherited by all jobs that will be started by the daemon
+			if (!SetProcessAffinityMask(GetCurrentProcess(), (DWORD_PTR)_tcstoui64(temp.c_str(), NULL, 16)))
+			{
+				std::cerr << "WARNING: Failed to set the processor affinity mask!\n" << std::endl;
+			}
+		}
+		return daemonMain(pipeName);
+	}
+
+	if (queryMode)
+	{
+		if (historyFile.empty())
+		{
+			std::cerr << "The history file must be specified by TIMED_EXEC_HISTORY in query mode!\n" << std::endl;
+			return EXIT_FAILURE;
+		}
+		_ftprintf(stderr, _T("History File:\n%s\n\n"), historyFile.c_str());
+		return queryHistory(historyFile);
+	}
+
 	/* ---------------------------------------------------------- */
 	/* Check Command-Line                                         */
 	/* ---------------------------------------------------------- */
@@ -447,12 +2407,28 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 		std::cerr << "  TimedExec.exe <Program.exe> [Arguments]\n" << std::endl;
 		std::cerr << "Influential environment variables:" << std::endl;
 		std::cerr << "  TIMED_EXEC_PASSES        - Number of execution passes (default: " << DEFAULT_EXEC_LOOPS << ")" << std::endl;
-		std::cerr << "  TIMED_EXEC_WARMUP_PASSES - Number of warm-up passes (default: " << DEFAULT_WARMUP_LOOPS << ")" << std::endl;
+		std::cerr << "  TIMED_EXEC_WARMUP_PASSES - Number of warm-up passes or \"auto\" (default: " << DEFAULT_WARMUP_LOOPS << ")" << std::endl;
+		std::cerr << "  TIMED_EXEC_WARMUP_MAX    - Max. number of automatic warm-up passes (default: " << DEFAULT_MAX_WARMUP_LOOPS << ")" << std::endl;
 		std::cerr << "  TIMED_EXEC_LOGFILE       - Log-File Name (default: \"" << DEFAULT_LOGFILE << "\")" << std::endl;
 		std::cerr << "  TIMED_EXEC_NO_CHECKS     - Do *not* check the process exit codes" << std::endl;
 		std::cerr << "  TIMED_EXEC_NO_PRIORITY   - Do *not* adjust the process priorities" << std::endl;
 		std::cerr << "  TIMED_EXEC_NO_PERIOD     - Do *not* adjust system timer period" << std::endl;
-		std::cerr << "  TIMED_EXEC_CLOCK_TYPE    - The type of clock used for measurements\n" << std::endl;
+		std::cerr << "  TIMED_EXEC_CLOCK_TYPE    - The type of clock used for measurements" << std::endl;
+		std::cerr << "  TIMED_EXEC_PHASE_TIMES   - Split each pass into loader, runtime and teardown phases" << std::endl;
+		std::cerr << "  TIMED_EXEC_MEMORY_LIMIT  - Maximum allowed peak memory usage, in MiB" << std::endl;
+		std::cerr << "  TIMED_EXEC_ALLOC_PROFILE - Count the heap allocations (injects a hook library)" << std::endl;
+		std::cerr << "  TIMED_EXEC_ALLOC_LIMIT   - Maximum allowed heap allocations per pass" << std::endl;
+		std::cerr << "  TIMED_EXEC_NO_HISTOGRAM  - Do *not* print the distribution histogram" << std::endl;
+		std::cerr << "  TIMED_EXEC_CHECKPOINT    - Checkpoint File Name (default: none)" << std::endl;
+		std::cerr << "  TIMED_EXEC_RESUME        - Resume from the checkpoint file, if possible" << std::endl;
+		std::cerr << "  TIMED_EXEC_DAEMON        - Run as daemon that executes queued jobs" << std::endl;
+		std::cerr << "  TIMED_EXEC_CLIENT        - Submit the job to the daemon (no program: status)" << std::endl;
+		std::cerr << "  TIMED_EXEC_PIPE_NAME     - Pipe Name (default: \"" << DEFAULT_PIPE_NAME << "\")" << std::endl;
+		std::cerr << "  TIMED_EXEC_AFFINITY      - Processor affinity mask of the daemon (hex)" << std::endl;
+		std::cerr << "  TIMED_EXEC_HISTORY       - History File Name (default: none)" << std::endl;
+		std::cerr << "  TIMED_EXEC_NAME          - Benchmark name in the history (default: program)" << std::endl;
+		std::cerr << "  TIMED_EXEC_TAG           - Commit or version tag in the history file" << std::endl;
+		std::cerr << "  TIMED_EXEC_QUERY         - Detect change points in the history file\n" << std::endl;
 		return EXIT_FAILURE;
 	}
 
@@ -472,10 +2448,11 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 	/* Check Environment Variables                                */
 	/* ---------------------------------------------------------- */
 
-	tstring logFile(getFullPath(_T(DEFAULT_LOGFILE)));
+	tstring logFile(getFullPath(_T(DEFAULT_LOGFILE))), checkpointFile, benchmarkName(getFileNameOnly(programFile)), benchmarkTag;
 	clock_type_t clock_type = CLOCK_WALLCLOCK;
 	int maxPasses = DEFAULT_EXEC_LOOPS, maxWarmUpPasses = DEFAULT_WARMUP_LOOPS;
-	bool checkExitCodes = true, adjustPriority = true, adjustPeriod = true;
+	double memoryLimit = 0.0, allocLimit = 0.0;
+	bool autoWarmUp = false, checkExitCodes = true, adjustPriority = true, adjustPeriod = true, measurePhases = false, allocProfile = false, printDistribution = true, resumeCheckpoint = false;
 
 	if (ENABLE_ENV_VARS)
 	{
@@ -486,7 +2463,18 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 		}
 		if (getEnvVariable(_T("TIMED_EXEC_WARMUP_PASSES"), temp))
 		{
-			maxWarmUpPasses = std::min(SHRT_MAX, std::max(0, _tstoi(temp.c_str())));
+			if (!(autoWarmUp = (!_tcsicmp(temp.c_str(), _T("auto")))))
+			{
+				maxWarmUpPasses = std::min(SHRT_MAX, std::max(0, _tstoi(temp.c_str())));
+			}
+		}
+		if (autoWarmUp)
+		{
+			maxWarmUpPasses = DEFAULT_MAX_WARMUP_LOOPS;
+			if (getEnvVariable(_T("TIMED_EXEC_WARMUP_MAX"), temp))
+			{
+				maxWarmUpPasses = std::min(SHRT_MAX, std::max((int)WARMUP_WINDOW, _tstoi(temp.c_str())));
+			}
 		}
 		if (getEnvVariable(_T("TIMED_EXEC_LOGFILE"), temp))
 		{
@@ -511,6 +2499,66 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 				_ftprintf(stderr, _T("WARNING: Specified clock type \"%s\" is unsupported. Using default clock type!\n\n"), temp.c_str());
 			}
 		}
+		if (getEnvVariable(_T("TIMED_EXEC_PHASE_TIMES"), temp))
+		{
+			measurePhases = parseFlag(temp);
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_MEMORY_LIMIT"), temp))
+		{
+			memoryLimit = std::max(0.0, _tstof(temp.c_str()));
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_ALLOC_PROFILE"), temp))
+		{
+			allocProfile = parseFlag(temp);
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_ALLOC_LIMIT"), temp))
+		{
+			// An allocation limit can only be enforced if the allocations are counted
+			if ((allocLimit = std::max(0.0, _tstof(temp.c_str()))) > 0.0)
+			{
+				allocProfile = true;
+			}
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_NO_HISTOGRAM"), temp))
+		{
+			printDistribution = (!parseFlag(temp));
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_CHECKPOINT"), temp) && (!temp.empty()))
+		{
+			checkpointFile = getFullPath(temp.c_str());
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_RESUME"), temp))
+		{
+			resumeCheckpoint = parseFlag(temp);
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_NAME"), temp) && (!temp.empty()))
+		{
+			benchmarkName = temp;
+		}
+		if (getEnvVariable(_T("TIMED_EXEC_TAG"), temp))
+		{
+			benchmarkTag = temp;
+		}
+	}
+
+	const tstring hookLibrary(allocProfile ? getHookLibraryPath() : tstring());
+	if (allocProfile)
+	{
+		if (measurePhases)
+		{
+			std::cerr << "Allocation profiling can not be combined with phase times, because the hook is injected by a remote thread!\n" << std::endl;
+			return EXIT_FAILURE;
+		}
+		if (!checkBinaryBitness(programFile))
+		{
+			_ftprintf(stderr, _T("Allocation profiling requires a program of the same bitness as TimedExec (use TimedExec-x86.exe or TimedExec-x64.exe):\n%s\n\n"), programFile.c_str());
+			return EXIT_FAILURE;
+		}
+		if (hookLibrary.empty() || (_taccess(hookLibrary.c_str(), 0) != 0))
+		{
+			_ftprintf(stderr, _T("The allocation hook library could not be found or access denied:\n%s\n\n"), hookLibrary.empty() ? ALLOC_HOOK_LIBRARY : hookLibrary.c_str());
+			return EXIT_FAILURE;
+		}
 	}
 
 	/* ---------------------------------------------------------- */
@@ -519,7 +2567,8 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 
 	_ftprintf(stderr, _T("Command-line:\n%s\n\n"), commandLine.c_str());
 	_ftprintf(stderr, _T("Log File:\n%s\n\n"), logFile.c_str());
-	std::cerr << "Warm-Up / Metering passes: " << maxWarmUpPasses << "x / " << maxPasses << 'x' << std::endl;
+	if (allocProfile) _ftprintf(stderr, _T("Allocation Hook:\n%s\n\n"), hookLibrary.c_str());
+	if (autoWarmUp) std::cerr << "Warm-Up / Metering passes: auto (max. " << maxWarmUpPasses << "x) / " << maxPasses << 'x' << std::endl; else std::cerr << "Warm-Up / Metering passes: " << maxWarmUpPasses << "x / " << maxPasses << 'x' << std::endl;
 
 	if (adjustPriority)
 	{
@@ -539,37 +2588,93 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 		}
 	}
 
-	std::vector<double> stats_samples(maxPasses, 0.0);
+	if (measurePhases)
+	{
+		// Processes created under a debugger use the (slow) debug heap by default, which would distort the measurement
+		SetEnvironmentVariable(_T("_NO_DEBUG_HEAP"), _T("1"));
+	}
+
+	std::vector<pass_result_t> results;
+	std::vector<double> stats_samples, stats_loader, stats_runtime, stats_teardown;
+	std::vector<double> stats_peakCommit, stats_peakWorkingSet, stats_pageFaults;
+	std::vector<double> stats_onCpu, stats_offCpu, stats_ioOperations, stats_ioTransfer;
+	std::vector<double> stats_allocations, stats_reallocations, stats_frees, stats_bytesAllocated, stats_peakLiveHeap;
+	std::vector<distribution_mode_t> modes;
+	std::vector<double> stats_warmUp;
+	bool steadyState = false;
+
+	/* ---------------------------------------------------------- */
+	/* Create or Resume Checkpoint                                */
+	/* ---------------------------------------------------------- */
 
-	double stats_mean     = 0.0;
-	double stats_variance = 0.0;
-	double stats_fastest  = DBL_MAX;
-	double stats_slowest  = 0.0;
+	FILE *fCheckpoint = NULL;
+	size_t resumedPasses = 0U;
+	long long checkpointSize = -1LL;
+	int unsyncedPasses = 0;
+	LONGLONG timeLastSync = getPerfCounter();
+	alloc_hook_t allocHook = { hookLibrary.c_str(), NULL, NULL };
+
+	if (!checkpointFile.empty())
+	{
+		char checkpointHeader[64];
+		sprintf_s(checkpointHeader, sizeof(checkpointHeader), "TimedExec-Checkpoint\t%d\t%016llX\t%d\t%d\t%d\n", CHECKPOINT_VERSION, hashString(commandLine), int(clock_type), int(measurePhases), int(allocProfile));
+		_ftprintf(stderr, _T("\nCheckpoint File:\n%s\n"), checkpointFile.c_str());
+		// Never overwrite an existing checkpoint file, unless it has been resumed successfully
+		if (GetFileAttributes(checkpointFile.c_str()) != INVALID_FILE_ATTRIBUTES)
+		{
+			if (!resumeCheckpoint)
+			{
+				_ftprintf(stderr, _T("\nThe checkpoint file already exists! Set TIMED_EXEC_RESUME to continue the previous test, or delete the file to start over.\n\n"));
+				goto cleanup;
+			}
+			if (!readCheckpoint(checkpointFile, checkpointHeader, (size_t)maxPasses, results, checkpointSize))
+			{
+				_ftprintf(stderr, _T("\nThe checkpoint file is invalid or does not match the current test (command-line, clock type, phase times or allocation profiling)! Delete the file to start over.\n\n"));
+				goto cleanup;
+			}
+			resumedPasses = results.size();
+			std::cerr << "\nResuming from checkpoint: " << results.size() << " of " << maxPasses << " metering passes have already been completed." << std::endl;
+		}
+		else if (resumeCheckpoint)
+		{
+			std::cerr << "\nNo checkpoint file found, starting from the first metering pass." << std::endl;
+		}
+		if (!(fCheckpoint = createCheckpoint(checkpointFile, checkpointHeader, checkpointSize)))
+		{
+			_ftprintf(stderr, _T("\nFailed to open the specified checkpoint file for writing:\n%s\n\n"), checkpointFile.c_str());
+			goto cleanup;
+		}
+	}
 
 	/* ---------------------------------------------------------- */
 	/* Run Warm-Up Passes                                         */
 	/* ---------------------------------------------------------- */
 
-	for (int pass = 0; pass < maxWarmUpPasses; pass++)
+	for (int pass = 0; (pass < maxWarmUpPasses) && (!steadyState); pass++)
 	{
 		std::cerr << "\n===============================================================================" << std::endl;
-		if (maxWarmUpPasses > 1) std::cerr << "WARM-UP PASS " << (pass + 1) << " OF " << maxWarmUpPasses << std::endl; else std::cerr << "WARM-UP PASS" << std::endl;
+		if (autoWarmUp) std::cerr << "WARM-UP PASS " << (pass + 1) << " (AUTOMATIC, MAX. " << maxWarmUpPasses << ')' << std::endl; else if (maxWarmUpPasses > 1) std::cerr << "WARM-UP PASS " << (pass + 1) << " OF " << maxWarmUpPasses << std::endl; else std::cerr << "WARM-UP PASS" << std::endl;
 		std::cerr << "===============================================================================\n" << std::endl;
 
 		HANDLE hThrd, hProc;
+		phase_times_t phases;
+		const LONGLONG timeStart = getPerfCounter();
 
-		if (!createProcess(commandLine, hThrd, hProc, adjustPriority))
+		// The warm-up passes run in the same mode (debugger, allocation hook) as the metering passes, so that they are comparable
+		if (!createProcess(commandLine, hThrd, hProc, adjustPriority, measurePhases, allocProfile ? &allocHook : NULL))
 		{
-			std::cerr << "\n\nSYSTEM ERROR: Failed to create process!\n" << std::endl;
+			std::cerr << (allocProfile ? "\n\nSYSTEM ERROR: Failed to create process or to inject the allocation hook!\n" : "\n\nSYSTEM ERROR: Failed to create process!\n") << std::endl;
 			goto cleanup;
 		}
 
-		if (!waitForProcess(hProc))
+		if (!(measurePhases ? waitForProcessPhases(hProc, timeStart, phases) : waitForProcess(hProc)))
 		{
 			std::cerr << "\n\nSYSTEM ERROR: Failed to wait for process termination!\n" << std::endl;
 			PROCESS_FAILED();
 		}
 
+		releaseAllocHook(allocHook);
+
 		if (g_aborted)
 		{
 			abortedHandlerRoutine(hProc);
@@ -587,38 +2692,69 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 			std::cerr << "\n>> Process terminated with exit code " << exitCode << '.' << std::endl;
 		}
 
+		// The warm-up passes are timed too, in order to detect the steady state and to determine the cold-start cost
+		const double warmUpTime = getProcessTime(hProc, clock_type);
+		stats_warmUp.push_back(warmUpTime);
+
+		std::cerr << std::setprecision(3) << std::fixed;
+		std::cerr << ">> Execution took " << warmUpTime << " seconds." << std::endl;
+		std::cerr.copyfmt(initFmt);
+
 		CloseHandle(hThrd);
 		CloseHandle(hProc);
+
+		if (autoWarmUp && (steadyState = checkSteadyState(stats_warmUp, clock_type)))
+		{
+			std::cerr << "\n>> Steady state has been reached after " << stats_warmUp.size() << " warm-up passes." << std::endl;
+		}
+	}
+
+	if (autoWarmUp && (!steadyState))
+	{
+		std::cerr << "\nWARNING: Steady state has *not* been reached after " << stats_warmUp.size() << " warm-up passes!" << std::endl;
 	}
 
 	/* ---------------------------------------------------------- */
 	/* Run Execution Passes                                       */
 	/* ---------------------------------------------------------- */
 
-	for(int pass = 0; pass < maxPasses; pass++)
+	for(int pass = (int)results.size(); pass < maxPasses; pass++)
 	{
 		std::cerr << "\n===============================================================================" << std::endl;
 		if (maxPasses > 1) std::cerr << "METERING PASS " << (pass + 1) << " OF " << maxPasses << std::endl; else std::cerr << "METERING PASS" << std::endl;
 		std::cerr << "===============================================================================\n" << std::endl;
 
 		HANDLE hThrd, hProc;
+		pass_result_t result;
+		SecureZeroMemory(&result, sizeof(pass_result_t));
+		const LONGLONG timeStart = getPerfCounter();
 
-		if (!createProcess(commandLine, hThrd, hProc, adjustPriority))
+		if (!createProcess(commandLine, hThrd, hProc, adjustPriority, measurePhases, allocProfile ? &allocHook : NULL))
 		{
-			std::cerr << "\n\nSYSTEM ERROR: Failed to create process!\n" << std::endl;
+			std::cerr << (allocProfile ? "\n\nSYSTEM ERROR: Failed to create process or to inject the allocation hook!\n" : "\n\nSYSTEM ERROR: Failed to create process!\n") << std::endl;
 			goto cleanup;
 		}
 		
-		if (!waitForProcess(hProc))
+		if (!(measurePhases ? waitForProcessPhases(hProc, timeStart, result.phases) : waitForProcess(hProc)))
 		{
 			std::cerr << "\n\nSYSTEM ERROR: Failed to wait for process termination!\n" << std::endl;
 			PROCESS_FAILED();
 		}
 
+		// The counters are read from the shared section, which remains valid after the process has terminated (or has been killed)
+		if (allocProfile)
+		{
+			getAllocCounters(allocHook, result.allocs);
+			releaseAllocHook(allocHook);
+		}
+
 		if (g_aborted)
 		{
+			// Keep the passes that have been completed so far, in order to print (and log) partial results
 			abortedHandlerRoutine(hProc);
-			PROCESS_FAILED();
+			CloseHandle(hThrd);
+			CloseHandle(hProc);
+			break;
 		}
 
 		const int exitCode = getProcessExitCode(hProc);
@@ -632,39 +2768,129 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 			std::cerr << "\n>> Process terminated with exit code " << exitCode << '.' << std::endl;
 		}
 
-		const double execTime = getProcessTime(hProc, clock_type);
+		result.execTime = getProcessTime(hProc, clock_type);
 
 		std::cerr << std::setprecision(3) << std::fixed;
-		std::cerr << ">> Execution took " << execTime << " seconds." << std::endl;
+		std::cerr << ">> Execution took " << result.execTime << " seconds." << std::endl;
+		if (measurePhases)
+		{
+			std::cerr << ">> Loader phase took " << result.phases.loader << " seconds, runtime phase took " << result.phases.runtime << " seconds, teardown phase took ";
+			if (result.phases.teardown >= 0.0)
+			{
+				std::cerr << result.phases.teardown << " seconds." << std::endl;
+			}
+			else
+			{
+				std::cerr << "N/A." << std::endl;
+			}
+		}
+
+		if (getProcessMemory(hProc, result.memory))
+		{
+			std::cerr << ">> Peak memory usage was " << result.memory.peakCommit << " MiB (Working Set: " << result.memory.peakWorkingSet << " MiB, Page Faults: " << static_cast<ULONGLONG>(result.memory.pageFaults) << ")." << std::endl;
+		}
+
+		// The counters of a terminated process remain available until the last handle to the process has been closed
+		if (getProcessBreakdown(hProc, result.breakdown))
+		{
+			std::cerr << ">> On-CPU time was " << result.breakdown.onCpu << " seconds, off-CPU time was ";
+			if (result.breakdown.offCpu >= 0.0)
+			{
+				std::cerr << result.breakdown.offCpu << " seconds";
+			}
+			else
+			{
+				std::cerr << "N/A";
+			}
+			std::cerr << " (I/O: " << static_cast<ULONGLONG>(result.breakdown.ioOperations) << " operations, " << result.breakdown.ioTransfer << " MiB)." << std::endl;
+		}
+		if (allocProfile)
+		{
+			std::cerr << ">> Heap allocations: " << static_cast<ULONGLONG>(result.allocs.allocations) << ", reallocations: " << static_cast<ULONGLONG>(result.allocs.reallocations) << ", frees: " << static_cast<ULONGLONG>(result.allocs.frees)
+				<< " (Allocated: " << result.allocs.bytesAllocated << " MiB, Peak Live Heap: " << result.allocs.peakLiveHeap << " MiB)." << std::endl;
+		}
 		std::cerr.copyfmt(initFmt);
 
+		if ((memoryLimit > 0.0) && (result.memory.peakCommit > memoryLimit))
+		{
+			std::cerr << "\n\nPROGRAM ERROR: Memory limit has been exceeded! (Peak Memory: " << result.memory.peakCommit << " MiB, Limit: " << memoryLimit << " MiB)\n" << std::endl;
+			PROCESS_FAILED();
+		}
+
+		if ((allocLimit > 0.0) && ((result.allocs.allocations + result.allocs.reallocations) > allocLimit))
+		{
+			std::cerr << "\n\nPROGRAM ERROR: Allocation limit has been exceeded! (Heap Allocations: " << static_cast<ULONGLONG>(result.allocs.allocations + result.allocs.reallocations) << ", Limit: " << static_cast<ULONGLONG>(allocLimit) << ")\n" << std::endl;
+			PROCESS_FAILED();
+		}
+
 		CloseHandle(hThrd);
 		CloseHandle(hProc);
 
 		// Store this sample
-		stats_samples[pass] = execTime;
+		results.push_back(result);
 
-		// Update slowest/fastest
-		if (execTime > stats_slowest) stats_slowest = execTime;
-		if (execTime < stats_fastest) stats_fastest = execTime;
+		// Append this sample to the checkpoint file; the file is flushed after every pass, but synced to the disk only in batches
+		if (fCheckpoint)
+		{
+			if (!writeCheckpoint(fCheckpoint, result))
+			{
+				std::cerr << "\nWARNING: Failed to append data to the checkpoint file!" << std::endl;
+			}
+			const LONGLONG timeNow = getPerfCounter();
+			if ((++unsyncedPasses >= CHECKPOINT_SYNC_PASSES) || (getPerfCounterElapsed(timeLastSync, timeNow) >= CHECKPOINT_SYNC_SECONDS))
+			{
+				syncCheckpoint(fCheckpoint);
+				unsyncedPasses = 0;
+				timeLastSync = timeNow;
+			}
+		}
+	}
 
-		// Iterative "online" computation of the mean and the variance
-		// See http://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Online_algorithm for details!
-		const double delta = execTime - stats_mean;
-		stats_mean += delta / ((double)(pass + 1));
-		stats_variance += delta * (execTime - stats_mean);
+	if (g_aborted && (results.size() < 2U))
+	{
+		goto cleanup;
 	}
 
-	stats_variance /= ((double)(maxPasses - 1));
+	for (std::vector<pass_result_t>::const_iterator iter = results.cbegin(); iter != results.cend(); ++iter)
+	{
+		stats_samples.push_back(iter->execTime);
+		stats_loader.push_back(iter->phases.loader);
+		stats_runtime.push_back(iter->phases.runtime);
+		if (iter->phases.teardown >= 0.0)
+		{
+			stats_teardown.push_back(iter->phases.teardown);
+		}
+		stats_peakCommit.push_back(iter->memory.peakCommit);
+		stats_peakWorkingSet.push_back(iter->memory.peakWorkingSet);
+		stats_pageFaults.push_back(iter->memory.pageFaults);
+		stats_onCpu.push_back(iter->breakdown.onCpu);
+		if (iter->breakdown.offCpu >= 0.0)
+		{
+			stats_offCpu.push_back(iter->breakdown.offCpu);
+		}
+		stats_ioOperations.push_back(iter->breakdown.ioOperations);
+		stats_ioTransfer.push_back(iter->breakdown.ioTransfer);
+		stats_allocations.push_back(iter->allocs.allocations);
+		stats_reallocations.push_back(iter->allocs.reallocations);
+		stats_frees.push_back(iter->allocs.frees);
+		stats_bytesAllocated.push_back(iter->allocs.bytesAllocated);
+		stats_peakLiveHeap.push_back(iter->allocs.peakLiveHeap);
+	}
 
 	/* ---------------------------------------------------------- */
 	/* Print Results                                              */
 	/* ---------------------------------------------------------- */
 
+	// Compute the mean and the variance, using the iterative "online" algorithm
+	// See http://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Online_algorithm for details!
+	const int completedPasses = (int)stats_samples.size();
+	sample_stats_t timeStats;
+	computeStatistics(stats_samples, timeStats);
+
 	// Compute the "standard error" and the "confidence" intervalls for our measurement
 	// See http://www.uni-siegen.de/phil/sozialwissenschaften/soziologie/mitarbeiter/ludwig-mayerhofer/statistik/statistik_downloads/konfidenzintervalle.pdf for details!
-	const double standardDeviation = sqrt(stats_variance);
-	const double standardError = standardDeviation / sqrt((double)(maxPasses - 1));
+	const double standardDeviation = timeStats.stddev;
+	const double standardError = standardDeviation / sqrt((double)(completedPasses - 1));
 	const double confidenceInterval_90 = 1.645 * standardError;
 	const double confidenceInterval_95 = 1.960 * standardError;
 	const double confidenceInterval_99 = 2.576 * standardError;
@@ -672,21 +2898,139 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 	//Compute median
 	const double medianTime = computeMedian(stats_samples);
 
+	//Analyze the distribution (note: the samples have been sorted by computeMedian)
+	const double resolution = getClockResolution(clock_type);
+	const double bandwidth = std::max(computeBandwidth(stats_samples, standardDeviation), resolution);
+	if (completedPasses >= MIN_DISTRIBUTION_PASSES)
+	{
+		computeModes(stats_samples, bandwidth, resolution, modes);
+	}
+
+	//Compute memory statistics
+	sample_stats_t peakCommitStats, peakWorkingSetStats, pageFaultStats;
+	computeStatistics(stats_peakCommit, peakCommitStats);
+	computeStatistics(stats_peakWorkingSet, peakWorkingSetStats);
+	computeStatistics(stats_pageFaults, pageFaultStats);
+
+	//Compute on-CPU/off-CPU statistics
+	sample_stats_t onCpuStats, offCpuStats, ioOperationStats, ioTransferStats;
+	computeStatistics(stats_onCpu, onCpuStats);
+	computeStatistics(stats_offCpu, offCpuStats);
+	computeStatistics(stats_ioOperations, ioOperationStats);
+	computeStatistics(stats_ioTransfer, ioTransferStats);
+
+	//Compute phase statistics
+	sample_stats_t loaderStats, runtimeStats, teardownStats;
+	computeStatistics(stats_loader, loaderStats);
+	computeStatistics(stats_runtime, runtimeStats);
+	computeStatistics(stats_teardown, teardownStats);
+
+	//Compute allocation statistics
+	sample_stats_t allocationStats, reallocationStats, freeStats, bytesAllocatedStats, peakLiveHeapStats;
+	computeStatistics(stats_allocations, allocationStats);
+	computeStatistics(stats_reallocations, reallocationStats);
+	computeStatistics(stats_frees, freeStats);
+	computeStatistics(stats_bytesAllocated, bytesAllocatedStats);
+	computeStatistics(stats_peakLiveHeap, peakLiveHeapStats);
+
 	//Print results
 	std::cerr << std::setprecision(3) << std::fixed;
 	std::cerr << "\n===============================================================================" << std::endl;
-	std::cerr << "TEST COMPLETED SUCCESSFULLY AFTER " << maxPasses << " METERING PASSES" << std::endl;
+	if (g_aborted) std::cerr << "TEST ABORTED AFTER " << completedPasses << " OF " << maxPasses << " METERING PASSES (PARTIAL RESULTS)" << std::endl; else std::cerr << "TEST COMPLETED SUCCESSFULLY AFTER " << completedPasses << " METERING PASSES" << std::endl;
 	std::cerr << "-------------------------------------------------------------------------------" << std::endl;
-	std::cerr << "Mean Execution Time     : " << stats_mean << " seconds" << std::endl;
+	std::cerr << "Mean Execution Time     : " << timeStats.mean << " seconds" << std::endl;
 	std::cerr << "Median Execution Time   : " << medianTime << " seconds" << std::endl;
-	std::cerr << "90% Confidence Interval : +/- " << confidenceInterval_90 << " (" << 100.0 * (confidenceInterval_90 / stats_mean) << "%) = [" << (stats_mean - confidenceInterval_90) << ", " << (stats_mean + confidenceInterval_90) << "] seconds" << std::endl;
-	std::cerr << "95% Confidence Interval : +/- " << confidenceInterval_95 << " (" << 100.0 * (confidenceInterval_95 / stats_mean) << "%) = [" << (stats_mean - confidenceInterval_95) << ", " << (stats_mean + confidenceInterval_95) << "] seconds" << std::endl;
-	std::cerr << "99% Confidence Interval : +/- " << confidenceInterval_99 << " (" << 100.0 * (confidenceInterval_99 / stats_mean) << "%) = [" << (stats_mean - confidenceInterval_99) << ", " << (stats_mean + confidenceInterval_99) << "] seconds" << std::endl;
+	std::cerr << "90% Confidence Interval : +/- " << confidenceInterval_90 << " (" << 100.0 * (confidenceInterval_90 / timeStats.mean) << "%) = [" << (timeStats.mean - confidenceInterval_90) << ", " << (timeStats.mean + confidenceInterval_90) << "] seconds" << std::endl;
+	std::cerr << "95% Confidence Interval : +/- " << confidenceInterval_95 << " (" << 100.0 * (confidenceInterval_95 / timeStats.mean) << "%) = [" << (timeStats.mean - confidenceInterval_95) << ", " << (timeStats.mean + confidenceInterval_95) << "] seconds" << std::endl;
+	std::cerr << "99% Confidence Interval : +/- " << confidenceInterval_99 << " (" << 100.0 * (confidenceInterval_99 / timeStats.mean) << "%) = [" << (timeStats.mean - confidenceInterval_99) << ", " << (timeStats.mean + confidenceInterval_99) << "] seconds" << std::endl;
 	std::cerr << "Standard Deviation      : " << standardDeviation << " seconds" << std::endl;
 	std::cerr << "Standard Error          : " << standardError << " seconds" << std::endl;
-	std::cerr << "Fastest / Slowest Pass  : " << stats_fastest << " / " << stats_slowest << " seconds" << std::endl;
+	std::cerr << "Fastest / Slowest Pass  : " << timeStats.fastest << " / " << timeStats.slowest << " seconds" << std::endl;
 	std::cerr << "Active Clock Type       : " << printClockType(clock_type) << " (" << clock_type << ')' << std::endl;
+	if (!stats_warmUp.empty())
+	{
+		std::cerr << "-------------------------------------------------------------------------------" << std::endl;
+		std::cerr << "Warm-Up Passes          : " << stats_warmUp.size() << (autoWarmUp ? (steadyState ? " (automatic, steady state reached)" : " (automatic, steady state *not* reached)") : "") << std::endl;
+		std::cerr << "Cold / Warm Execution   : " << stats_warmUp.front() << " / " << medianTime << " seconds (";
+		if (medianTime > 0.0)
+		{
+			std::cerr << std::showpos << 100.0 * ((stats_warmUp.front() / medianTime) - 1.0) << std::noshowpos << '%';
+		}
+		else
+		{
+			std::cerr << "N/A";
+		}
+		std::cerr << " cold-start cost)" << std::endl;
+	}
+	std::cerr << "-------------------------------------------------------------------------------" << std::endl;
+	std::cerr << "On-CPU Time Mean/Med.   : " << onCpuStats.mean << " / " << onCpuStats.median << " seconds (Range: " << onCpuStats.fastest << " - " << onCpuStats.slowest << ')' << std::endl;
+	if (!stats_offCpu.empty())
+	{
+		std::cerr << "Off-CPU Time Mean/Med.  : " << offCpuStats.mean << " / " << offCpuStats.median << " seconds (Range: " << offCpuStats.fastest << " - " << offCpuStats.slowest;
+		if (stats_offCpu.size() < results.size())
+		{
+			std::cerr << ", N/A in " << (results.size() - stats_offCpu.size()) << " passes";
+		}
+		std::cerr << ')' << std::endl;
+	}
+	else
+	{
+		std::cerr << "Off-CPU Time Mean/Med.  : N/A (on-CPU time exceeded the wall-clock time)" << std::endl;
+	}
+	std::cerr << "I/O Transfer Mean/Med.  : " << ioTransferStats.mean << " / " << ioTransferStats.median << " MiB (Operations: " << std::setprecision(0) << ioOperationStats.median << std::setprecision(3) << ')' << std::endl;
+	std::cerr << "-------------------------------------------------------------------------------" << std::endl;
+	std::cerr << "Peak Memory Mean/Med.   : " << peakCommitStats.mean << " / " << peakCommitStats.median << " MiB (Range: " << peakCommitStats.fastest << " - " << peakCommitStats.slowest << ')' << std::endl;
+	std::cerr << "Working Set Mean/Med.   : " << peakWorkingSetStats.mean << " / " << peakWorkingSetStats.median << " MiB (Range: " << peakWorkingSetStats.fastest << " - " << peakWorkingSetStats.slowest << ')' << std::endl;
+	std::cerr << std::setprecision(0);
+	std::cerr << "Page Faults Mean/Med.   : " << pageFaultStats.mean << " / " << pageFaultStats.median << " (Range: " << pageFaultStats.fastest << " - " << pageFaultStats.slowest << ')' << std::endl;
+	std::cerr << std::setprecision(3);
+	if (measurePhases)
+	{
+		std::cerr << "-------------------------------------------------------------------------------" << std::endl;
+		std::cerr << "Loader Phase Mean/Med.  : " << loaderStats.mean << " / " << loaderStats.median << " seconds (Std. Dev.: " << loaderStats.stddev << ", Range: " << loaderStats.fastest << " - " << loaderStats.slowest << ')' << std::endl;
+		std::cerr << "Runtime Phase Mean/Med. : " << runtimeStats.mean << " / " << runtimeStats.median << " seconds (Std. Dev.: " << runtimeStats.stddev << ", Range: " << runtimeStats.fastest << " - " << runtimeStats.slowest << ')' << std::endl;
+		if (!stats_teardown.empty())
+		{
+			std::cerr << "Teardown Phase Mean/Med.: " << teardownStats.mean << " / " << teardownStats.median << " seconds (Std. Dev.: " << teardownStats.stddev << ", Range: " << teardownStats.fastest << " - " << teardownStats.slowest << ')' << std::endl;
+		}
+		else
+		{
+			std::cerr << "Teardown Phase Mean/Med.: N/A (the process did not exit via RtlExitUserProcess)" << std::endl;
+		}
+		std::cerr << "Note: All times were measured under a debugger, compare them with phase time runs only!" << std::endl;
+	}
+	if (allocProfile)
+	{
+		std::cerr << "-------------------------------------------------------------------------------" << std::endl;
+		std::cerr << std::setprecision(0);
+		std::cerr << "Heap Allocs Mean/Med.   : " << allocationStats.mean << " / " << allocationStats.median << " (Range: " << allocationStats.fastest << " - " << allocationStats.slowest << ')' << std::endl;
+		std::cerr << "Reallocs / Frees Med.   : " << reallocationStats.median << " / " << freeStats.median << " (Range: " << reallocationStats.fastest << " - " << reallocationStats.slowest << " / " << freeStats.fastest << " - " << freeStats.slowest << ')' << std::endl;
+		std::cerr << std::setprecision(3);
+		std::cerr << "Allocated Mean/Med.     : " << bytesAllocatedStats.mean << " / " << bytesAllocatedStats.median << " MiB (Range: " << bytesAllocatedStats.fastest << " - " << bytesAllocatedStats.slowest << ')' << std::endl;
+		std::cerr << "Peak Live Heap Mean/Med.: " << peakLiveHeapStats.mean << " / " << peakLiveHeapStats.median << " MiB (Range: " << peakLiveHeapStats.fastest << " - " << peakLiveHeapStats.slowest << ')' << std::endl;
+		std::cerr << "Note: All times were measured with the allocation hook, compare them with allocation profiling runs only!" << std::endl;
+	}
 	std::cerr << "===============================================================================\n" << std::endl;
+
+	if (completedPasses >= MIN_DISTRIBUTION_PASSES)
+	{
+		if (printDistribution)
+		{
+			std::cerr << "DISTRIBUTION OF EXECUTION TIMES (# = passes, * = kernel density estimate)" << std::endl;
+			std::cerr << "-------------------------------------------------------------------------------" << std::endl;
+			printHistogram(stats_samples, bandwidth);
+			std::cerr << "-------------------------------------------------------------------------------\n" << std::endl;
+		}
+		if (modes.size() > 1U)
+		{
+			std::cerr << "WARNING: The execution times have a multimodal distribution (" << modes.size() << " modes detected)!" << std::endl;
+			for (size_t i = 0; i < modes.size(); ++i)
+			{
+				std::cerr << "  Mode #" << (i + 1U) << ": " << modes[i].center << " seconds (" << std::setprecision(1) << (100.0 * modes[i].weight) << "% of all passes)" << std::setprecision(3) << std::endl;
+			}
+			std::cerr << "Comparing the mean or median execution time with other results is *not* safe.\n" << std::endl;
+		}
+	}
 	std::cerr.copyfmt(initFmt);
 
 	/* ---------------------------------------------------------- */
@@ -696,11 +3040,13 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 	FILE *fLog = NULL;
 	if (_tfopen_s(&fLog, logFile.c_str(), _T("a+")) == 0)
 	{
-		if (getCurrentFileSize(fLog) == 0)
+		if ((getCurrentFileSize(fLog) == 0) || (!checkLogHeader(fLog)))
 		{
-			_ftprintf_s(fLog, _T("%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n"), _T("Program"), _T("Passes"), _T("Mean Time"), _T("Median Time"), _T("90% Confidence Interval"), _T("95% Confidence Interval"), _T("99% Confidence Interval"), _T("Fastest Pass"), _T("Slowest Pass"), _T("Standard Deviation"), _T("Standard Error"), _T("Command Line"));
+			_ftprintf_s(fLog, _T("%s\n"), LOG_FILE_HEADER);
 		}
-		_ftprintf_s(fLog, _T("%s\t%d\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%s\n"), getFileNameOnly(programFile).c_str(), maxPasses, stats_mean, medianTime, confidenceInterval_90, confidenceInterval_95, confidenceInterval_99, stats_fastest, stats_slowest, standardDeviation, standardError, commandLine.c_str());
+		_ftprintf_s(fLog, _T("%s\t%d\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%.0f\t%f\t%s\t%f\t%d\t%d\t%f\t%s\t%s\t%s\t%s\t%d\t%s\t%s\t%s\t%s\t%s\t%s\n"), getFileNameOnly(programFile).c_str(), completedPasses, timeStats.mean, medianTime, confidenceInterval_90, confidenceInterval_95, confidenceInterval_99, timeStats.fastest, timeStats.slowest, standardDeviation, standardError,
+			peakCommitStats.median, peakWorkingSetStats.median, pageFaultStats.median, onCpuStats.median, formatValue(offCpuStats.median, !stats_offCpu.empty()).c_str(), ioTransferStats.median, (int)std::max<size_t>(1U, modes.size()), (int)stats_warmUp.size(), stats_warmUp.empty() ? 0.0 : stats_warmUp.front(), formatValue(loaderStats.median, measurePhases).c_str(), formatValue(runtimeStats.median, measurePhases).c_str(), formatValue(teardownStats.median, measurePhases && (!stats_teardown.empty())).c_str(), g_aborted ? _T("Aborted") : _T("Completed"), (int)resumedPasses,
+			formatValue(allocationStats.median, allocProfile).c_str(), formatValue(reallocationStats.median, allocProfile).c_str(), formatValue(freeStats.median, allocProfile).c_str(), formatValue(bytesAllocatedStats.median, allocProfile).c_str(), formatValue(peakLiveHeapStats.median, allocProfile).c_str(), commandLine.c_str());
 		if (ferror(fLog) == 0)
 		{
 			_ftprintf(stderr, _T("Log file updated successfully.\n\n"));
@@ -716,13 +3062,50 @@ static int timedExecMain(int argc, _TCHAR* argv[])
 		_ftprintf(stderr, _T("Failed to open the specified log file for writing:\n%s\n\n"), logFile.c_str());
 	}
 
+	/* ---------------------------------------------------------- */
+	/* Update History File                                        */
+	/* ---------------------------------------------------------- */
+
+	if ((!historyFile.empty()) && (!g_aborted))
+	{
+		history_record_t record;
+		initHistoryRecord(record, benchmarkName, benchmarkTag, clock_type, measurePhases);
+		record.median = medianTime;
+		record.mean = timeStats.mean;
+		record.stddev = standardDeviation;
+		record.fastest = timeStats.fastest;
+		record.slowest = timeStats.slowest;
+		record.passes = (DWORD)completedPasses;
+		if (appendHistory(historyFile, record))
+		{
+			_ftprintf(stderr, _T("History file updated successfully.\n\n"));
+		}
+		else
+		{
+			_ftprintf(stderr, _T("Failed to append data to the specified history file:\n%s\n\n"), historyFile.c_str());
+		}
+	}
+
 	/* ---------------------------------------------------------- */
 	/* Goodbye!                                                   */
 	/* ---------------------------------------------------------- */
 
-	exitCode = EXIT_SUCCESS;
+	if (!g_aborted)
+	{
+		exitCode = EXIT_SUCCESS;
+		if (fCheckpoint)
+		{
+			fclose(fCheckpoint); fCheckpoint = NULL;
+			DeleteFile(checkpointFile.c_str());
+		}
+	}
 
 cleanup:
+	if (fCheckpoint)
+	{
+		syncCheckpoint(fCheckpoint);
+		fclose(fCheckpoint); fCheckpoint = NULL;
+	}
 	resetTimerResolution(timerPeriod);
 	return exitCode;
 }
@@ -111,6 +111,8 @@ mkdir "%PACK_PATH%"
 
 copy "%~dp0\bin\Win32\Release\TimedExec.exe" "%PACK_PATH%\TimedExec-x86.exe"
 copy "%~dp0\bin\x64\.\Release\TimedExec.exe" "%PACK_PATH%\TimedExec-x64.exe"
+copy "%~dp0\bin\Win32\Release\TimedExecHook-x86.dll" "%PACK_PATH%"
+copy "%~dp0\bin\x64\.\Release\TimedExecHook-x64.dll" "%PACK_PATH%"
 copy "%~dp0\LICENSE.html"                    "%PACK_PATH%"
 
 "%PDOC_PATH%\pandoc.exe" --from markdown_github+pandoc_title_block+header_attributes+implicit_figures+inline_notes --to html5 -N --metadata title="TimedExec" --standalone -H "%~dp0\..\Prerequisites\Pandoc\css\github-pandoc.inc" "README.md" | "%JAVA_HOME%\bin\java.exe" -jar "%~dp0\..\Prerequisites\HTMLCompressor\bin\htmlcompressor-1.5.3.jar" --compress-css -o "%PACK_PATH%\README.html"